@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <linux/mman.h>
+
+#include "macros.h"
+using namespace std;
+
+// Backing allocator for large preallocated containers (MemPool, LFQueue, SPSCLFQueue)
+// tries 1GB / 2MB hugetlb pages first, then falls back to transparent huge pages via madvise
+// every page is faulted in at construction and the region is mlocked,
+// so the hot path never takes a first touch page fault and needs far fewer TLB entries
+// huge pages need to be reserved by the admin (vm.nr_hugepages) to be available
+// prints one line per process with what it actually got, and one more only if a later region got less
+
+namespace Common {
+    constexpr size_t PAGE_SIZE_4KB = 4 * 1024;
+    constexpr size_t PAGE_SIZE_2MB = 2 * 1024 * 1024;
+    constexpr size_t PAGE_SIZE_1GB = 1024 * 1024 * 1024;
+
+    // bytes in front of every region, remembers how big the mapping is so deallocate can unmap it
+    constexpr size_t HUGE_PAGE_HEADER_SIZE = 64;
+
+    inline auto roundUp(size_t n, size_t to) noexcept {
+        return ((n + to - 1) / to) * to;
+    }
+
+    // allocations happen in many places at startup, a line each would bury the one that matters
+    // -> the first region says what backs it, any later one that got different pages or no mlock is reported once
+    // mlock_error 0 -> region is mlocked
+    inline auto reportHugePages(size_t mapped_len, const char *page_kind, int mlock_error) noexcept -> void {
+        static atomic<const char *> first_page_kind{nullptr};
+        static atomic<int> first_mlock_error{0};
+        static atomic<bool> difference_reported{false};
+        const auto locked_str = (mlock_error ? "mlock() failed error:" + string(strerror(mlock_error)) : string("mlocked"));
+        const char *no_page_kind = nullptr;
+        if(first_page_kind.compare_exchange_strong(no_page_kind, page_kind)) {
+            first_mlock_error = mlock_error;
+            cerr << "HugePageAllocator backed by " << page_kind << ", prefaulted, " << locked_str << " (first region " << mapped_len << " bytes)" << endl;
+            return;
+        }
+        if((strcmp(page_kind, no_page_kind) || (mlock_error && !first_mlock_error)) && !difference_reported.exchange(true)) {
+            cerr << "HugePageAllocator region of " << mapped_len << " bytes backed by " << page_kind << ", " << locked_str << endl;
+        }
+    }
+
+    // returns start of a mapping which is atleast len bytes, actual length of the mapping in mapped_len
+    // page_kind describes what backs the mapping
+    inline auto mapHugePages(size_t len, size_t *mapped_len, const char **page_kind) noexcept -> void * {
+        const auto prot = PROT_READ | PROT_WRITE;
+        const auto flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+        // explicit huge pages, MAP_POPULATE faults them all in right away
+        if(len >= PAGE_SIZE_1GB) {
+            *mapped_len = roundUp(len, PAGE_SIZE_1GB);
+            auto ptr = mmap(nullptr, *mapped_len, prot, flags | MAP_HUGETLB | MAP_HUGE_1GB | MAP_POPULATE, -1, 0);
+            if(ptr != MAP_FAILED) {
+                *page_kind = "1GB hugetlb pages";
+                return ptr;
+            }
+        }
+        *mapped_len = roundUp(len, PAGE_SIZE_2MB);
+        auto ptr = mmap(nullptr, *mapped_len, prot, flags | MAP_HUGETLB | MAP_HUGE_2MB | MAP_POPULATE, -1, 0);
+        if(ptr != MAP_FAILED) {
+            *page_kind = "2MB hugetlb pages";
+            return ptr;
+        }
+
+        // no hugetlb pages reserved, use normal pages aligned to 2MB and ask for transparent huge pages
+        // one extra 2MB is mapped so the start can be aligned, the unused head and tail are unmapped again
+        auto raw = static_cast<char *>(mmap(nullptr, *mapped_len + PAGE_SIZE_2MB, prot, flags, -1, 0));
+        if(raw == MAP_FAILED) {
+            FATAL("mmap() failed for " + to_string(*mapped_len) + " bytes. error:" + string(strerror(errno)));
+        }
+        auto aligned = reinterpret_cast<char *>(roundUp(reinterpret_cast<uintptr_t>(raw), PAGE_SIZE_2MB));
+        if(aligned != raw) {
+            munmap(raw, aligned - raw);
+        }
+        munmap(aligned + *mapped_len, (raw + PAGE_SIZE_2MB) - aligned);
+
+        *page_kind = (madvise(aligned, *mapped_len, MADV_HUGEPAGE) == 0 ? "transparent huge pages" : "4KB pages (madvise failed)");
+        // touch every page after madvise, so the kernel can back them with huge pages right away
+        for(size_t i = 0; i < *mapped_len; i += PAGE_SIZE_4KB) {
+            aligned[i] = 0;
+        }
+        return aligned;
+    }
+
+    template<typename T>
+    class HugePageAllocator {
+        public:
+        typedef T value_type;
+
+        HugePageAllocator() noexcept = default;
+
+        template<typename U>
+        HugePageAllocator(const HugePageAllocator<U> &) noexcept {}
+
+        auto allocate(size_t n) -> T * {
+            static_assert(alignof(T) <= HUGE_PAGE_HEADER_SIZE, "HugePageAllocator cannot align T");
+            size_t mapped_len = 0;
+            const char *page_kind = nullptr;
+            auto region = static_cast<char *>(mapHugePages(HUGE_PAGE_HEADER_SIZE + n * sizeof(T), &mapped_len, &page_kind));
+            // keep the pages resident, never swapped out or reclaimed
+            reportHugePages(mapped_len, page_kind, (mlock(region, mapped_len) == 0 ? 0 : errno));
+            memcpy(region, &mapped_len, sizeof(mapped_len));
+            return reinterpret_cast<T *>(region + HUGE_PAGE_HEADER_SIZE);
+        }
+
+        auto deallocate(T *ptr, size_t) noexcept -> void {
+            auto region = reinterpret_cast<char *>(ptr) - HUGE_PAGE_HEADER_SIZE;
+            size_t mapped_len = 0;
+            memcpy(&mapped_len, region, sizeof(mapped_len));
+            munmap(region, mapped_len);
+        }
+    };
+
+    // stateless, memory from one allocator can be freed by any other
+    template<typename T, typename U>
+    inline auto operator==(const HugePageAllocator<T> &, const HugePageAllocator<U> &) noexcept {
+        return true;
+    }
+
+    template<typename T, typename U>
+    inline auto operator!=(const HugePageAllocator<T> &, const HugePageAllocator<U> &) noexcept {
+        return false;
+    }
+}
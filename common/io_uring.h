@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "macros.h"
+using namespace std;
+
+// bare io_uring on top of the raw syscalls, no liburing
+// submission queue -> we fill sqes and move the tail, kernel moves the head
+// completion queue -> kernel fills cqes and moves the tail, we move the head
+// both rings are shared memory, reaping completions never enters the kernel, submitting is one io_uring_enter() for the whole batch
+// single threaded, the thread that submits also reaps
+
+namespace Common {
+    class IoUring final {
+    public:
+        // cq_entries > sq_entries -> multishot requests post many completions for one submission
+        IoUring(uint32_t sq_entries, uint32_t cq_entries) {
+            io_uring_params params{};
+            params.flags = IORING_SETUP_CQSIZE;
+            params.cq_entries = cq_entries;
+            ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, sq_entries, &params));
+            ASSERT(ring_fd_ >= 0, "io_uring_setup() failed. error:" + string(strerror(errno)));
+            ASSERT(params.features & IORING_FEAT_NODROP, "io_uring without IORING_FEAT_NODROP, kernel too old");
+
+            sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+            cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if(params.features & IORING_FEAT_SINGLE_MMAP) {
+                // both rings live in one mapping
+                sq_ring_size_ = cq_ring_size_ = max(sq_ring_size_, cq_ring_size_);
+            }
+            sq_ring_ = mapRing(sq_ring_size_, IORING_OFF_SQ_RING);
+            cq_ring_ = ((params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ring_ : mapRing(cq_ring_size_, IORING_OFF_CQ_RING));
+            sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+            sqes_ = reinterpret_cast<io_uring_sqe *>(mapRing(sqes_size_, IORING_OFF_SQES));
+
+            sq_head_ = reinterpret_cast<uint32_t *>(sq_ring_ + params.sq_off.head);
+            sq_tail_ = reinterpret_cast<uint32_t *>(sq_ring_ + params.sq_off.tail);
+            sq_flags_ = reinterpret_cast<uint32_t *>(sq_ring_ + params.sq_off.flags);
+            sq_mask_ = *reinterpret_cast<uint32_t *>(sq_ring_ + params.sq_off.ring_mask);
+            sq_entries_ = params.sq_entries;
+            // sqe i always goes in slot i, the indirection array is filled once
+            auto sq_array = reinterpret_cast<uint32_t *>(sq_ring_ + params.sq_off.array);
+            for(uint32_t i = 0; i < sq_entries_; ++i) {
+                sq_array[i] = i;
+            }
+
+            cq_head_ = reinterpret_cast<uint32_t *>(cq_ring_ + params.cq_off.head);
+            cq_tail_ = reinterpret_cast<uint32_t *>(cq_ring_ + params.cq_off.tail);
+            cq_mask_ = *reinterpret_cast<uint32_t *>(cq_ring_ + params.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<io_uring_cqe *>(cq_ring_ + params.cq_off.cqes);
+            stashed_cqes_.reserve(params.cq_entries);
+        }
+
+        ~IoUring() {
+            for(auto &buffers : buffer_groups_) {
+                if(buffers.data_) {
+                    munmap(buffers.data_, buffers.data_size_);
+                }
+            }
+            munmap(sqes_, sqes_size_);
+            if(cq_ring_ != sq_ring_) {
+                munmap(cq_ring_, cq_ring_size_);
+            }
+            munmap(sq_ring_, sq_ring_size_);
+            close(ring_fd_);
+        }
+
+        // zeroed sqe to fill in, goes to the kernel with the next submit()
+        // a full submission queue is flushed first
+        auto getSqe() noexcept -> io_uring_sqe * {
+            // sq full -> the kernel has to take some first, a slot is only reused once it has
+            // EBUSY -> the cq overflowed and nobody reaps it in here, its completions are moved aside to make room, forEachCqe() hands them out first
+            while(UNLIKELY(sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_)) {
+                if(UNLIKELY(!submit())) {
+                    stashCqes();
+                }
+            }
+            auto sqe = &sqes_[sqe_tail_ & sq_mask_];
+            memset(sqe, 0, sizeof(*sqe));
+            ++sqe_tail_;
+            return sqe;
+        }
+
+        // hands every sqe from getSqe() to the kernel in one io_uring_enter()
+        // also enters the kernel when completions overflowed the cq, so that they get flushed into it
+        // false -> EBUSY, the kernel took nothing until completions are reaped
+        auto submit() noexcept -> bool {
+            const auto to_submit = sqe_tail_ - submitted_tail_;
+            const auto overflow = (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW);
+            if(!to_submit && !overflow) {
+                return true;
+            }
+            __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+            long n = 0;
+            do {
+                n = syscall(__NR_io_uring_enter, ring_fd_, to_submit, 0, (overflow ? IORING_ENTER_GETEVENTS : 0), nullptr, 0);
+            } while(UNLIKELY(n < 0 && errno == EINTR));
+            if(UNLIKELY(n < 0)) {
+                // EBUSY -> completions overflowed and the kernel takes no more until they are reaped
+                // nothing was taken, the sqes stay in the sq ring and go with the next submit()
+                ASSERT(errno == EBUSY, "io_uring_enter() failed. error:" + string(strerror(errno)));
+                return false;
+            }
+            // kernel can take fewer than asked for, the rest stays in the sq ring for the next submit()
+            submitted_tail_ += static_cast<uint32_t>(n);
+            return true;
+        }
+
+        // calls f(cqe) on every completion posted so far, each slot goes back to the kernel before f sees its copy
+        // completions of our own buffer requests never reach f
+        template<typename F>
+        auto forEachCqe(F &&f) noexcept -> void {
+            const auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            // moved aside by getSqe(), posted before anything still in the ring
+            forEachStashedCqe(f);
+            // head re-read every time, f can move the rest of the ring aside through getSqe()
+            for(auto head = *cq_head_; static_cast<int32_t>(tail - head) > 0; head = *cq_head_) {
+                // copied and its slot handed back before f runs -> the kernel has room for completions of whatever f submits
+                const auto cqe = cqes_[head & cq_mask_];
+                __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+                onCqe(cqe, f);
+            }
+            forEachStashedCqe(f);
+        }
+
+        // num_buffers buffers of buffer_size bytes as provided buffer group group_id, given to the kernel with the next submit()
+        // recv sqes with IOSQE_BUFFER_SELECT pick a free one from the group when data arrives
+        auto provideBuffers(uint16_t group_id, uint16_t num_buffers, uint32_t buffer_size) -> void {
+            ASSERT(group_id < buffer_groups_.size() && !buffer_groups_[group_id].data_, "Bad or already provided buffer group:" + to_string(group_id));
+            auto &buffers = buffer_groups_[group_id];
+            buffers.data_size_ = static_cast<size_t>(num_buffers) * buffer_size;
+            auto data = mmap(nullptr, buffers.data_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+            ASSERT(data != MAP_FAILED, "mmap() failed for " + to_string(buffers.data_size_) + " bytes of provided buffers. error:" + string(strerror(errno)));
+            buffers.data_ = static_cast<char *>(data);
+            buffers.buffer_size_ = buffer_size;
+            provide(group_id, 0, num_buffers);
+        }
+
+        // data of buffer buffer_id, valid until the buffer is recycled
+        auto buffer(uint16_t group_id, uint16_t buffer_id) const noexcept -> char * {
+            const auto &buffers = buffer_groups_[group_id];
+            return buffers.data_ + static_cast<size_t>(buffer_id) * buffers.buffer_size_;
+        }
+
+        // gives a buffer back to the kernel once its data has been used, goes with the next submit()
+        auto recycleBuffer(uint16_t group_id, uint16_t buffer_id) noexcept -> void {
+            provide(group_id, buffer_id, 1);
+        }
+
+        IoUring() = delete;
+        IoUring(const IoUring &) = delete;
+        IoUring(const IoUring &&) = delete;
+        IoUring &operator=(const IoUring &) = delete;
+        IoUring &operator=(const IoUring &&) = delete;
+
+    private:
+        // user_data of the sqes handing buffers to the kernel
+        static constexpr uint64_t ProvideBuffersUserData = ~0ULL;
+
+        struct BufferGroup {
+            char *data_ = nullptr;
+            size_t data_size_ = 0;
+            uint32_t buffer_size_ = 0;
+        };
+
+        int ring_fd_ = -1;
+
+        char *sq_ring_ = nullptr;
+        size_t sq_ring_size_ = 0;
+        uint32_t *sq_head_ = nullptr;
+        uint32_t *sq_tail_ = nullptr;
+        uint32_t *sq_flags_ = nullptr;
+        uint32_t sq_mask_ = 0;
+        uint32_t sq_entries_ = 0;
+        io_uring_sqe *sqes_ = nullptr;
+        size_t sqes_size_ = 0;
+        // next sqe handed out by getSqe() / first one the kernel has not been told about yet
+        uint32_t sqe_tail_ = 0;
+        uint32_t submitted_tail_ = 0;
+
+        char *cq_ring_ = nullptr;
+        size_t cq_ring_size_ = 0;
+        uint32_t *cq_head_ = nullptr;
+        uint32_t *cq_tail_ = nullptr;
+        uint32_t cq_mask_ = 0;
+        io_uring_cqe *cqes_ = nullptr;
+
+        // completions taken out of the ring by getSqe() to get past EBUSY, in the order they were posted
+        vector<io_uring_cqe> stashed_cqes_;
+
+        array<BufferGroup, 4> buffer_groups_;
+
+        template<typename F>
+        auto onCqe(const io_uring_cqe &cqe, F &f) noexcept -> void {
+            if(UNLIKELY(cqe.user_data == ProvideBuffersUserData)) {
+                // only failures post a completion
+                ASSERT(cqe.res >= 0, "IORING_OP_PROVIDE_BUFFERS failed. error:" + string(strerror(-cqe.res)));
+                return;
+            }
+            f(cqe);
+        }
+
+        // indexed, f can stash more while this runs, those come after
+        template<typename F>
+        auto forEachStashedCqe(F &f) noexcept -> void {
+            if(LIKELY(stashed_cqes_.empty())) {
+                return;
+            }
+            for(size_t i = 0; i < stashed_cqes_.size(); ++i) {
+                const auto cqe = stashed_cqes_[i];
+                onCqe(cqe, f);
+            }
+            stashed_cqes_.clear();
+        }
+
+        // every completion in the ring moved aside -> the kernel can flush its overflow into the freed slots and take sqes again
+        auto stashCqes() noexcept -> void {
+            const auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            for(auto head = *cq_head_; head != tail; ++head) {
+                stashed_cqes_.push_back(cqes_[head & cq_mask_]);
+            }
+            __atomic_store_n(cq_head_, tail, __ATOMIC_RELEASE);
+        }
+
+        // buffers buffer_id .. buffer_id + num_buffers - 1 of the group back to the kernel, no completion unless it fails
+        auto provide(uint16_t group_id, uint16_t buffer_id, uint16_t num_buffers) noexcept -> void {
+            const auto &buffers = buffer_groups_[group_id];
+            auto sqe = getSqe();
+            sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+            sqe->fd = num_buffers;
+            sqe->addr = reinterpret_cast<uint64_t>(buffer(group_id, buffer_id));
+            sqe->len = buffers.buffer_size_;
+            sqe->off = buffer_id;
+            sqe->buf_group = group_id;
+            sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+            sqe->user_data = ProvideBuffersUserData;
+        }
+
+        auto mapRing(size_t size, off_t offset) -> char * {
+            auto ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+            ASSERT(ring != MAP_FAILED, "mmap() failed for io_uring ring. error:" + string(strerror(errno)));
+            return static_cast<char *>(ring);
+        }
+    };
+}
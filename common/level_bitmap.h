@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <limits>
+
+#include "macros.h"
+using namespace std;
+
+// Hierarchical occupancy bitmap over a fixed range of indices (eg. price levels)
+// 3 levels of 64 bit words -> bit in a summary word is set if the word below it is non zero
+// find next / prev set index is a handful of tzcnt / lzcnt instructions, independent of how sparse it is
+
+namespace Common {
+    class LevelBitmap final {
+        public:
+        static constexpr size_t WORD_BITS = 64;
+        static constexpr size_t MAX_BITS = WORD_BITS * WORD_BITS * WORD_BITS;
+        static constexpr size_t NPOS = numeric_limits<size_t>::max();
+
+        explicit LevelBitmap(size_t num_bits): num_bits_(num_bits), l0_((num_bits + WORD_BITS - 1) / WORD_BITS, 0), l1_((l0_.size() + WORD_BITS - 1) / WORD_BITS, 0) {
+            ASSERT(num_bits > 0 && num_bits <= MAX_BITS, "LevelBitmap supports upto " + to_string(MAX_BITS) + " bits, requested:" + to_string(num_bits));
+        }
+
+        auto size() const noexcept {
+            return num_bits_;
+        }
+
+        auto test(size_t i) const noexcept -> bool {
+            return (l0_[i / WORD_BITS] >> (i % WORD_BITS)) & 1;
+        }
+
+        auto set(size_t i) noexcept {
+            const auto w = i / WORD_BITS;
+            l0_[w] |= (1ull << (i % WORD_BITS));
+            l1_[w / WORD_BITS] |= (1ull << (w % WORD_BITS));
+            l2_ |= (1ull << (w / WORD_BITS));
+        }
+
+        auto clear(size_t i) noexcept {
+            const auto w = i / WORD_BITS;
+            l0_[w] &= ~(1ull << (i % WORD_BITS));
+            // summary bits only cleared once the whole word below is empty
+            if(!l0_[w]) {
+                const auto w1 = w / WORD_BITS;
+                l1_[w1] &= ~(1ull << (w % WORD_BITS));
+                if(!l1_[w1]) {
+                    l2_ &= ~(1ull << w1);
+                }
+            }
+        }
+
+        // lowest set index >= i, NPOS if none
+        auto findNext(size_t i) const noexcept -> size_t {
+            if(UNLIKELY(i >= num_bits_)) {
+                return NPOS;
+            }
+            const auto w = i / WORD_BITS;
+            const auto m0 = l0_[w] & (~0ull << (i % WORD_BITS));
+            if(m0) {
+                return w * WORD_BITS + __builtin_ctzll(m0);
+            }
+            // next non empty word after w inside the same summary word
+            const auto w1 = w / WORD_BITS;
+            const auto b1 = w % WORD_BITS + 1;
+            const auto m1 = (b1 < WORD_BITS ? l1_[w1] & (~0ull << b1) : 0);
+            if(m1) {
+                return firstInWord(w1 * WORD_BITS + __builtin_ctzll(m1));
+            }
+            // next non empty summary word after w1
+            const auto b2 = w1 + 1;
+            const auto m2 = (b2 < WORD_BITS ? l2_ & (~0ull << b2) : 0);
+            if(!m2) {
+                return NPOS;
+            }
+            const auto nw1 = static_cast<size_t>(__builtin_ctzll(m2));
+            return firstInWord(nw1 * WORD_BITS + __builtin_ctzll(l1_[nw1]));
+        }
+
+        // highest set index <= i, NPOS if none
+        auto findPrev(size_t i) const noexcept -> size_t {
+            if(UNLIKELY(i == NPOS)) {
+                return NPOS;
+            }
+            if(i >= num_bits_) {
+                i = num_bits_ - 1;
+            }
+            const auto w = i / WORD_BITS;
+            const auto b0 = i % WORD_BITS;
+            const auto m0 = l0_[w] & (b0 == WORD_BITS - 1 ? ~0ull : ((1ull << (b0 + 1)) - 1));
+            if(m0) {
+                return w * WORD_BITS + (WORD_BITS - 1 - __builtin_clzll(m0));
+            }
+            // previous non empty word before w inside the same summary word
+            const auto w1 = w / WORD_BITS;
+            const auto m1 = l1_[w1] & ((1ull << (w % WORD_BITS)) - 1);
+            if(m1) {
+                return lastInWord(w1 * WORD_BITS + (WORD_BITS - 1 - __builtin_clzll(m1)));
+            }
+            // previous non empty summary word before w1
+            const auto m2 = l2_ & ((1ull << w1) - 1);
+            if(!m2) {
+                return NPOS;
+            }
+            const auto pw1 = WORD_BITS - 1 - __builtin_clzll(m2);
+            return lastInWord(pw1 * WORD_BITS + (WORD_BITS - 1 - __builtin_clzll(l1_[pw1])));
+        }
+
+        auto first() const noexcept -> size_t {
+            return findNext(0);
+        }
+
+        auto last() const noexcept -> size_t {
+            return findPrev(num_bits_ - 1);
+        }
+
+        auto empty() const noexcept -> bool {
+            return !l2_;
+        }
+
+        LevelBitmap() = delete;
+        LevelBitmap(const LevelBitmap &) = delete;
+        LevelBitmap(const LevelBitmap &&) = delete;
+        LevelBitmap &operator=(const LevelBitmap &) = delete;
+        LevelBitmap &operator=(const LevelBitmap &&) = delete;
+
+        private:
+        auto firstInWord(size_t w) const noexcept -> size_t {
+            return w * WORD_BITS + __builtin_ctzll(l0_[w]);
+        }
+
+        auto lastInWord(size_t w) const noexcept -> size_t {
+            return w * WORD_BITS + (WORD_BITS - 1 - __builtin_clzll(l0_[w]));
+        }
+
+        size_t num_bits_ = 0;
+        vector<uint64_t> l0_; // one bit per index
+        vector<uint64_t> l1_; // one bit per l0_ word
+        uint64_t l2_ = 0; // one bit per l1_ word
+    };
+}
@@ -3,6 +3,8 @@
 #include <iostream>
 #include <vector>
 #include <atomic>
+#include <memory>
+#include <algorithm>
 
 #include "macros.h"
 using namespace std;
@@ -11,7 +13,8 @@ using namespace std;
 // read, write index, number of elements are all atomic<size_t>
 
 namespace Common {
-    template<typename T> 
+    // Allocator -> backing storage for the elements, eg. HugePageAllocator, defaults to the heap
+    template<typename T, typename Allocator = allocator<T>> 
     class LFQueue final {
         public:
 
@@ -28,6 +31,19 @@ namespace Common {
             num_elements_++;
         }
 
+        // batch version, reserves upto max_elems contiguous free slots, count returned in num_elems
+        // stops at the end of the store, so the slots never wrap around
+        auto getNextToWriteTo(size_t max_elems, size_t *num_elems) noexcept {
+            *num_elems = min({max_elems, store_.size() - num_elements_, store_.size() - next_write_index_});
+            return &store_[next_write_index_];
+        }
+
+        // publishes num_elems elements written to the slots from the batch getNextToWriteTo()
+        auto updateWriteIndex(size_t num_elems) noexcept {
+            next_write_index_ = (next_write_index_ + num_elems) % store_.size();
+            num_elements_ += num_elems;
+        }
+
         auto getNextToRead() const noexcept -> const T * {
             // if the queue is empty there is nothing to consume
             // returns pointer to actual element at next_read_index
@@ -40,6 +56,19 @@ namespace Common {
             num_elements_--;
         }
 
+        // batch version, returns upto max_elems contiguous elements starting at next read index, count returned in num_elems
+        auto getNextToRead(size_t max_elems, size_t *num_elems) const noexcept -> const T * {
+            *num_elems = min({max_elems, num_elements_.load(), store_.size() - next_read_index_});
+            return (*num_elems ? &store_[next_read_index_] : nullptr);
+        }
+
+        // releases num_elems elements from the batch getNextToRead()
+        auto updateReadIndex(size_t num_elems) noexcept {
+            next_read_index_ = (next_read_index_ + num_elems) % store_.size();
+            ASSERT(num_elements_ >= num_elems, "Read invalid elements in:" + std::to_string(pthread_self()));
+            num_elements_ -= num_elems;
+        }
+
         auto size() const noexcept {
             return num_elements_.load();
         }
@@ -52,7 +81,7 @@ namespace Common {
 
         private:
 
-        vector<T> store_; // memory pre allocated in vector
+        vector<T, Allocator> store_; // memory pre allocated in vector
         atomic<size_t> next_write_index_ = {0};
         atomic<size_t> next_read_index_ = {0};
         atomic<size_t> num_elements_ = {0};
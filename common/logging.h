@@ -1,193 +1,280 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <cstdio>
+#include <type_traits>
+#include <limits>
 
 #include "macros.h"
-#include "lf_queue.h"
+#include "spsc_lf_queue.h"
+#include "huge_page_allocator.h"
 #include "thread_utils.h"
 #include "time_utils.h"
 using namespace std;
 
-// Pushes data into lock free queue, disk writing IO operation done by seperate thread
+// Binary logger, log() only copies one record into a ring buffer, formatting and disk writing IO done by seperate thread
+// record -> pointer to the static format string, rdtsc() timestamp, raw bytes of the arguments
+// one ring per Logger, a Logger is only ever written to by the thread that owns it
 
 namespace Common {
-    constexpr size_t LOG_QUEUE_SIZE = 8 * 1024 * 1024;
-
-    enum class LogType: int8_t {
-        CHAR = 0,
-        INTEGER = 1,
-        LONG_INTEGER = 2,
-        LONG_LONG_INTEGER = 3,
-        UNSIGNED_INTEGER = 4,
-        UNSIGNED_LONG_INTEGER = 5,
-        UNSIGNED_LONG_LONG_INTEGER = 6,
-        FLOAT = 7,
-        DOUBLE = 8,
-    }; // tells the consumer the how to interpret data 
-
-    struct LogElement {
-        LogType type_ = LogType::CHAR; // one entry can only have one data type
-        union {
-            char c;
-            int i;
-            long l;
-            long long ll;
-            unsigned int ui;
-            unsigned long ul;
-            unsigned long long ull;
-            float f;
-            double d;
-        } u_;
-    }; // different data types share the same memory space
+    constexpr size_t LOG_QUEUE_SIZE = 64 * 1024 * 1024; // bytes, has to be a power of 2
 
-    class Logger final {
-        public:
-        auto flushQueue() noexcept {
-            while (running_) {
-                for (auto next = queue_.getNextToRead(); queue_.size() && next; next = queue_.getNextToRead()) {
-                    switch(next->type_) {
-                        case LogType::CHAR:
-                        file_ << next->u_.c;
-                        break;
-                        case LogType::INTEGER:
-                        file_ << next->u_.i;
-                        break;
-                        case LogType::LONG_INTEGER:
-                        file_ << next->u_.l;
-                        break;
-                        case LogType::LONG_LONG_INTEGER:
-                        file_ << next->u_.ll;
-                        break;
-                        case LogType::UNSIGNED_INTEGER:
-                        file_ << next->u_.ui;
-                        break;
-                        case LogType::UNSIGNED_LONG_INTEGER:
-                        file_ << next->u_.ul;
-                        break;
-                        case LogType::UNSIGNED_LONG_LONG_INTEGER:
-                        file_ << next->u_.ull;
-                        break;
-                        case LogType::FLOAT:
-                        file_ << next->u_.f;
-                        break;
-                        case LogType::DOUBLE:
-                        file_ << next->u_.d;
-                        break;
-                    }
-                    queue_.updateReadIndex();
-                }
-                file_.flush();
-                // file_ is of type std::ofstream, has internal buffer, stores data and writes in chunks
-                // flush() forces it to write data currently in the buffer
+    // pass in place of getCurrentTimeStr(), the record timestamp gets printed there in the same ctime format
+    struct LogTime {};
+    constexpr LogTime LOG_TIME;
 
-                using namespace literals::chrono_literals;
-                this_thread::sleep_for(10ms); // flushes every 10ms
-            }
-        }
+    // how one argument type is copied into a record and printed back out of it on the logger thread
+    // encode() / decode() return the number of bytes written / read
+    // default -> objects with toString(), eg. MEClientResponse, copied as raw bytes, toString() only runs on the logger thread
+    template<typename T, typename = void>
+    struct LogArg {
+        static_assert(is_trivially_copyable_v<T>, "log() arguments have to be numbers, strings or trivially copyable types with toString()");
 
-        // input: name of the log file
-        explicit Logger(const string &file_name): file_name_(file_name), queue_(LOG_QUEUE_SIZE) {
-            file_.open(file_name);
-            ASSERT(file_.is_open(), "Could not open file:" + file_name);
-            // starting thread and assigning it function for periodic flushing
-            logger_thread_ = createAndStartThread(-1, "Common/Logger " + file_name_, [this]() {flushQueue();});
-            ASSERT(logger_thread_ != nullptr, "Could not create logger thread");
-        } 
+        static auto size(const T &) noexcept -> size_t {
+            return sizeof(T);
+        }
 
-        ~Logger() {
-            string time_str;
-            cerr << Common::getCurrentTimeStr(&time_str) << " flushing and closing logger for " << file_name_ << endl;
-            running_ = false;
-            logger_thread_->join(); // waits for background to finish
-            file_.close();
-            cerr << Common::getCurrentTimeStr(&time_str) << " Logger for " << file_name_ << " exiting." << std::endl;
+        static auto encode(char *dst, const T &value) noexcept -> size_t {
+            memcpy(dst, &value, sizeof(T));
+            return sizeof(T);
         }
 
-        auto pushValue(const LogElement &log_element) noexcept {
-            *(queue_.getNextToWriteTo()) = log_element;
-            queue_.updateWriteIndex();
+        static auto decode(ostream &os, const char *src, Nanos) -> size_t {
+            alignas(T) char value[sizeof(T)]; // record bytes are not aligned for T
+            memcpy(value, src, sizeof(T));
+            os << reinterpret_cast<const T *>(value)->toString();
+            return sizeof(T);
         }
+    };
 
-        auto pushValue(const char value) noexcept {
-            pushValue(LogElement{LogType::CHAR, {.c = value}});
+    template<typename T>
+    struct LogArg<T, enable_if_t<is_arithmetic_v<T>>> {
+        static auto size(const T &) noexcept -> size_t {
+            return sizeof(T);
         }
 
-        auto pushValue(const int value) noexcept {
-            pushValue(LogElement{LogType::INTEGER, {.i = value}});
+        static auto encode(char *dst, const T &value) noexcept -> size_t {
+            memcpy(dst, &value, sizeof(T));
+            return sizeof(T);
         }
 
-        auto pushValue(const long value) noexcept {
-            pushValue(LogElement{LogType::LONG_INTEGER, {.l = value}});
+        static auto decode(ostream &os, const char *src, Nanos) -> size_t {
+            T value;
+            memcpy(&value, src, sizeof(T));
+            os << value;
+            return sizeof(T);
         }
+    };
 
-        auto pushValue(const long long value) noexcept {
-            pushValue(LogElement{LogType::LONG_LONG_INTEGER, {.ll = value}});
+    // strings are copied, caller's buffer can be gone by the time the record is formatted
+    // stored as length followed by the characters
+    struct LogStringArg {
+        static auto size(string_view value) noexcept -> size_t {
+            return sizeof(uint32_t) + value.size();
         }
 
-        auto pushValue(const unsigned value) noexcept {
-            pushValue(LogElement{LogType::UNSIGNED_INTEGER, {.ui = value}});
+        static auto encode(char *dst, string_view value) noexcept -> size_t {
+            const auto len = static_cast<uint32_t>(value.size());
+            memcpy(dst, &len, sizeof(len));
+            memcpy(dst + sizeof(len), value.data(), len);
+            return sizeof(len) + len;
         }
 
-        auto pushValue(const unsigned long value) noexcept {
-            pushValue(LogElement{LogType::UNSIGNED_LONG_INTEGER, {.ul = value}});
+        static auto decode(ostream &os, const char *src, Nanos) -> size_t {
+            uint32_t len;
+            memcpy(&len, src, sizeof(len));
+            os.write(src + sizeof(len), len);
+            return sizeof(len) + len;
         }
+    };
 
-        auto pushValue(const unsigned long long value) noexcept {
-            pushValue(LogElement{LogType::UNSIGNED_LONG_LONG_INTEGER, {.ull = value}});
+    template<> struct LogArg<const char *>: LogStringArg {};
+    template<> struct LogArg<char *>: LogStringArg {};
+    template<> struct LogArg<string>: LogStringArg {};
+    template<> struct LogArg<string_view>: LogStringArg {};
+
+    template<>
+    struct LogArg<LogTime> {
+        static auto size(const LogTime &) noexcept -> size_t {
+            return 0;
         }
 
-        auto pushValue(const float value) noexcept {
-            pushValue(LogElement{LogType::FLOAT, {.f = value}});
+        static auto encode(char *, const LogTime &) noexcept -> size_t {
+            return 0;
         }
 
-        auto pushValue(const double value) noexcept {
-            pushValue(LogElement{LogType::DOUBLE, {.d = value}});
+        static auto decode(ostream &os, const char *, Nanos time) -> size_t {
+            thread_local string time_str; // only ever used on the logger thread, no allocation per record
+            os << nanosToTimeStr(time, &time_str);
+            return 0;
         }
+    };
 
-        auto pushValue(const char *value) noexcept {
-            while(*value) {
-                pushValue(*value);
-                ++value;
+    // writes format string characters upto the next % which takes an argument, %% is an escaped %
+    // arguments are matched to placeholders at compile time, see LogFormat
+    inline auto writeFormatUntilArg(ostream &os, const char *&fmt) {
+        while(*fmt) {
+            if(*fmt == '%') {
+                if(UNLIKELY(*(fmt + 1) == '%')) {
+                    ++fmt;
+                } else {
+                    ++fmt;
+                    return;
+                }
             }
+            os.put(*fmt++);
         }
+    }
 
-        auto pushValue(const string &value) noexcept {
-            pushValue(value.c_str());
-        }
+    template<typename T>
+    inline auto formatLogArg(ostream &os, const char *&fmt, const char *args, Nanos time) -> size_t {
+        writeFormatUntilArg(os, fmt);
+        return LogArg<T>::decode(os, args, time);
+    }
+
+    // instantiated once per list of argument types, knows how to read back the arguments of a record
+    template<typename... A>
+    inline auto formatLogRecord(ostream &os, const char *fmt, const char *args, Nanos time) -> void {
+        ((args += formatLogArg<A>(os, fmt, args, time)), ...); // left to right, same order as the arguments were written
+        writeFormatUntilArg(os, fmt); // rest of the format string after the last placeholder
+    }
+
+    // not constexpr on purpose, calling it from LogFormat turns a mismatch into a compile error pointing at the log() call
+    inline auto log_format_placeholder_count_does_not_match_number_of_arguments() {}
 
-        template<typename T, typename... A> 
-        auto log(const char *s, const T &value, A... args) noexcept {
-            // allows for writing data with multiple formatted values
-            // T: type of the next element to be logged, A: remaning params in the statement
-            while(*s) {
-                if (*s == '%') {
-                    if (UNLIKELY(*(s+1) == '%')){
-                        ++s;
+    // format string of one log() call, parsed at compile time
+    // counts the placeholders (% not followed by another %) and rejects the call if they do not match the arguments
+    // nothing is left to check at runtime, the record only keeps the pointer to the literal
+    template<typename... A>
+    class LogFormat final {
+        public:
+        consteval LogFormat(const char *s): fmt_(s) {
+            size_t num_placeholders = 0;
+            for(auto c = s; *c; ++c) {
+                if(*c == '%') {
+                    if(*(c + 1) == '%') {
+                        ++c;
                     } else {
-                        pushValue(value);
-                        log(s+1, args...);
-                        return;
+                        ++num_placeholders;
                     }
                 }
-                pushValue(*s++);
             }
-            FATAL("extra arguments provided to log()");
+            if(num_placeholders != sizeof...(A)) {
+                log_format_placeholder_count_does_not_match_number_of_arguments();
+            }
         }
 
-        // use this version of log when the params are only string values
-        auto log(const char *s) noexcept {
-            while(*s) {
-                if(*s == '%') {
-                    if (UNLIKELY(*(s+1)=='%')){
-                        ++s;
-                    } else {
-                        FATAL("missing arguments in log");
-                    }
+        auto str() const noexcept {
+            return fmt_;
+        }
+
+        private:
+        const char *fmt_ = nullptr;
+    };
+
+    typedef void (*LogFormatFn)(ostream &os, const char *fmt, const char *args, Nanos time);
+
+    // fixed header in front of the argument bytes of every record
+    struct LogRecord {
+        size_t size_ = 0; // header + arguments + padding, LOG_RECORD_WRAP means continue at the start of the ring
+        LogFormatFn format_ = nullptr;
+        const char *fmt_ = nullptr;
+        uint64_t tsc_ = 0;
+    };
+
+    constexpr size_t LOG_RECORD_WRAP = numeric_limits<size_t>::max();
+
+    class Logger final {
+        public:
+        // formats every record published so far and writes it to the file
+        auto flushRecords() noexcept {
+            auto read_index = consumer_.read_index_.load(memory_order_relaxed);
+            const auto write_index = producer_.write_index_.load(memory_order_acquire);
+            while(read_index != write_index) {
+                const auto record = reinterpret_cast<const LogRecord *>(&ring_[read_index & mask_]);
+                if(record->size_ == LOG_RECORD_WRAP) {
+                    read_index += ring_.size() - (read_index & mask_);
+                    continue;
                 }
-                pushValue(*s++);
+                record->format_(file_, record->fmt_, reinterpret_cast<const char *>(record + 1), tscToNanos(record->tsc_));
+                read_index += record->size_;
+            }
+            consumer_.read_index_.store(read_index, memory_order_release);
+
+            const auto dropped = producer_.dropped_.load(memory_order_relaxed);
+            if(UNLIKELY(dropped != reported_dropped_)) {
+                file_ << "Logger queue full, dropped " << (dropped - reported_dropped_) << " records\n";
+                reported_dropped_ = dropped;
+            }
+        }
+
+        auto flushQueue() noexcept {
+            while (running_) {
+                flushRecords();
+                file_.flush();
+                // file_ is of type std::ofstream, has internal buffer, stores data and writes in chunks
+                // flush() forces it to write data currently in the buffer
+
+                using namespace literals::chrono_literals;
+                this_thread::sleep_for(10ms); // flushes every 10ms
             }
+            // records logged after the last pass
+            flushRecords();
+            file_.flush();
+        }
+
+        // input: name of the log file
+        explicit Logger(const string &file_name): file_name_(file_name), ring_(LOG_QUEUE_SIZE), mask_(LOG_QUEUE_SIZE - 1) {
+            static_assert(!(LOG_QUEUE_SIZE & (LOG_QUEUE_SIZE - 1)), "LOG_QUEUE_SIZE must be a power of 2");
+            file_.open(file_name);
+            ASSERT(file_.is_open(), "Could not open file:" + file_name);
+            // starting thread and assigning it function for periodic flushing
+            logger_thread_ = createAndStartThread(-1, "Common/Logger " + file_name_, [this]() {flushQueue();});
+            ASSERT(logger_thread_ != nullptr, "Could not create logger thread");
+        }
+
+        ~Logger() {
+            string time_str;
+            cerr << Common::getCurrentTimeStr(&time_str) << " flushing and closing logger for " << file_name_ << endl;
+            running_ = false;
+            logger_thread_->join(); // waits for background to finish
+            file_.close();
+            cerr << Common::getCurrentTimeStr(&time_str) << " Logger for " << file_name_ << " exiting." << std::endl;
+        }
+
+        // every % in s is replaced by the next argument, %% prints a single %
+        // s has to be a string literal, checked at compile time, only the pointer is stored and read later on the logger thread
+        // numbers / strings / LOG_TIME / trivially copyable objects with toString() can be passed as arguments
+        template<typename... A>
+        auto log(LogFormat<type_identity_t<A>...> s, const A &...args) noexcept {
+            const auto tsc = rdtsc();
+            const auto size = roundUp(sizeof(LogRecord) + (size_t{0} + ... + LogArg<decay_t<A>>::size(args)), alignof(LogRecord));
+
+            auto write_index = producer_.write_index_.load(memory_order_relaxed);
+            // record has to be contiguous, if it does not fit before the end of the ring skip the rest and start from the beginning
+            const auto pos = write_index & mask_;
+            const auto pad = (pos + size > ring_.size() ? ring_.size() - pos : 0);
+            if(UNLIKELY(ring_.size() - (write_index - producer_.cached_read_index_) < pad + size)) {
+                producer_.cached_read_index_ = consumer_.read_index_.load(memory_order_acquire);
+                if(UNLIKELY(ring_.size() - (write_index - producer_.cached_read_index_) < pad + size)) {
+                    // never block the caller, logger thread reports how many records were lost
+                    producer_.dropped_.store(producer_.dropped_.load(memory_order_relaxed) + 1, memory_order_relaxed);
+                    return;
+                }
+            }
+            if(pad) {
+                reinterpret_cast<LogRecord *>(&ring_[pos])->size_ = LOG_RECORD_WRAP;
+                write_index += pad;
+            }
+
+            auto record = reinterpret_cast<LogRecord *>(&ring_[write_index & mask_]);
+            *record = {size, &formatLogRecord<decay_t<A>...>, s.str(), tsc};
+            auto args_dst = reinterpret_cast<char *>(record + 1);
+            ((args_dst += LogArg<decay_t<A>>::encode(args_dst, args)), ...);
+
+            producer_.write_index_.store(write_index + size, memory_order_release);
         }
 
         Logger() = delete;
@@ -200,9 +287,28 @@ namespace Common {
         const string file_name_;
         ofstream file_;
 
-        LFQueue<LogElement> queue_;
+        // written by the thread that logs
+        struct alignas(CACHE_LINE_SIZE) ProducerIndices {
+            atomic<size_t> write_index_ = {0};
+            size_t cached_read_index_ = 0;
+            atomic<size_t> dropped_ = {0};
+        };
+
+        // written by the logger thread
+        struct alignas(CACHE_LINE_SIZE) ConsumerIndices {
+            atomic<size_t> read_index_ = {0};
+        };
+
+        alignas(CACHE_LINE_SIZE) vector<char, HugePageAllocator<char>> ring_;
+        const size_t mask_;
+
+        ProducerIndices producer_;
+        ConsumerIndices consumer_;
+
+        size_t reported_dropped_ = 0;
+
         atomic<bool> running_ = {true};
         thread *logger_thread_ = nullptr;
 
     };
-}
\ No newline at end of file
+}
@@ -13,6 +13,7 @@ namespace Common {
             port, 
             true,
             is_listening,
+            false,
             false
         }; // does not need timestamps
         socket_fd_ = createSocket(logger_, socket_cfg);
@@ -38,7 +39,7 @@ namespace Common {
 
         if(n_rcv > 0) {
             next_rcv_valid_index_ += n_rcv;
-            logger_.log("%:% %() % read socket:% len:%\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_), socket_fd_, next_rcv_valid_index_);
+            logger_.log("%:% %() % read socket:% len:%\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, socket_fd_, next_rcv_valid_index_);
             // update the recv index and call the callback function
             recv_callback_(this);
         }
@@ -46,7 +47,7 @@ namespace Common {
         // send data buffered in the outbound_data_ vector 
         if(next_send_valid_index_ > 0) {
             ssize_t n = ::send(socket_fd_, outbound_data_.data(), next_send_valid_index_, MSG_DONTWAIT | MSG_NOSIGNAL);
-            logger_.log("%:% %() % send socket:% len:%\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_), socket_fd_, n);
+            logger_.log("%:% %() % send socket:% len:%\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, socket_fd_, n);
         }
         next_send_valid_index_ = 0;
         // return true if any data was read 
@@ -33,7 +33,6 @@ namespace Common {
         size_t next_rcv_valid_index_ = 0;
 
         function<void(McastSocket *s)> recv_callback_ = nullptr;
-        string time_str_;
         Logger &logger_;
     };
 }
\ No newline at end of file
@@ -3,40 +3,68 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <type_traits>
+#include <memory>
 
 #include "macros.h"
 using namespace std;
 
-// Used to preallocate large pools of memeory 
+// Used to preallocate large pools of memeory
 // Avoid high cost frequent memory allocations
 
+// free blocks are linked into a free list through their own (unused) storage
+// allocate pops the head of the list, deallocate pushes the block back -> both O(1), no scanning
+// most recently freed block is handed out first, it is the one most likely to still be in cache
+
 namespace Common {
-    template<typename T>
+    // Allocator -> backing storage for the blocks, eg. HugePageAllocator, defaults to the heap
+    template<typename T, typename Allocator = allocator<T>>
     class MemPool final {
+        // blocks on the free list are overwritten with the next free index, T is never destroyed there
+        static_assert(is_trivially_destructible_v<T>, "MemPool only supports trivially destructible types");
+
         public:
-        // one takes one param -> size of the mem pool 
-        explicit MemPool(size_t num_elems): store_(num_elems, {T(), true}) {
-            ASSERT(reinterpret_cast<const ObjectBlock *>(&(store_[0].object_)) == &(store_[0]), "T object must be the first member of ObjectBlock");
+        // one takes one param -> size of the mem pool
+        explicit MemPool(size_t num_elems): store_(num_elems) {
+            // initially every block is free, block i points to block i + 1
+            for(size_t i = 0; i < num_elems; ++i) {
+                store_[i].next_free_index_ = i + 1;
+            }
+#if !defined(NDEBUG)
+            is_free_.assign(num_elems, true);
+#endif
         }
 
-        template<typename... Args> 
+        template<typename... Args>
         T *allocate(Args ...args) noexcept {
+            if(UNLIKELY(next_free_index_ == store_.size())) {
+                FATAL("Memory pool out of space");
+            }
             auto obj_block = &(store_[next_free_index_]); // get next free ObjectBlock
-            ASSERT(obj_block->is_free_, "Expected free ObjectBlock at index:" + to_string(next_free_index_));
+#if !defined(NDEBUG)
+            ASSERT(is_free_[next_free_index_], "Expected free ObjectBlock at index:" + to_string(next_free_index_));
+            is_free_[next_free_index_] = false;
+#endif
+            next_free_index_ = obj_block->next_free_index_; // pop the head of the free list
             T *ret = &(obj_block->object_); // pointer to object_ inside current ObjectBlock
             ret = new(ret) T(args...); // placement new, run constructor of T and memory address of ret
-            obj_block->is_free_ = false;
-            updateNextFreeIndex();
             return ret;
         }
 
         auto deallocate(const T *elem) noexcept {
-            // Convert T to ObjectBlock pointer 
-            // possible because T is first member of ObjectBlock, will point to the same location
+            // Convert T to ObjectBlock pointer
+            // possible because object_ is a member of the ObjectBlock union, will point to the same location
             const auto elem_index = (reinterpret_cast<const ObjectBlock *>(elem) - &store_[0]);
-            ASSERT(elem_index >= 0 && static_cast<size_t>(elem_index) < store_.size(), "Element being deallocated does not belong to this Memory pool.");
-            ASSERT(!store_[elem_index].is_free_, "Expected in-use ObjectBlock at index:" + std::to_string(elem_index));
-            store_[elem_index].is_free_ = true; // the object is still there, but is marked as free, can be overwritten
+            if(UNLIKELY(elem_index < 0 || static_cast<size_t>(elem_index) >= store_.size())) {
+                FATAL("Element being deallocated does not belong to this Memory pool.");
+            }
+#if !defined(NDEBUG)
+            ASSERT(!is_free_[elem_index], "Expected in-use ObjectBlock at index:" + std::to_string(elem_index));
+            is_free_[elem_index] = true;
+#endif
+            // push the block to the front of the free list
+            store_[elem_index].next_free_index_ = next_free_index_;
+            next_free_index_ = elem_index;
         }
 
         MemPool() = delete;
@@ -46,27 +74,24 @@ namespace Common {
         MemPool &operator=(const MemPool &&) = delete;
 
         private:
-        auto updateNextFreeIndex() noexcept {
-            const auto initial_free_index = next_free_index_;
-            // iterate until you get ObjectBlock marked as free
-            while(!store_[next_free_index_].is_free_) {
-                ++next_free_index_;
-                if(UNLIKELY(next_free_index_ == store_.size())) {
-                    next_free_index_ = 0;
-                }
-                if(UNLIKELY(initial_free_index == next_free_index_)){
-                    ASSERT(initial_free_index != next_free_index_, "Memory pool out of space");
-                }
-            }
-        }
-
-        struct ObjectBlock {
+        // either holds a live object or, when free, the index of the next free block
+        // no flag stored next to the object, so blocks are exactly as big as T
+        union ObjectBlock {
             T object_;
-            bool is_free_ = true;
+            size_t next_free_index_;
+
+            ObjectBlock(): next_free_index_(0) {}
+            ~ObjectBlock() {}
         };
 
-        vector<ObjectBlock> store_;
+        vector<ObjectBlock, typename allocator_traits<Allocator>::template rebind_alloc<ObjectBlock>> store_;
+        // head of the free list, store_.size() when the pool is empty
         size_t next_free_index_ = 0;
         // will be typically used by only one thread so no atomic variable needed
+
+#if !defined(NDEBUG)
+        // debug builds only, catches double allocate / deallocate
+        vector<bool> is_free_;
+#endif
     };
-}
\ No newline at end of file
+}
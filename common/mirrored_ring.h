@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "macros.h"
+using namespace std;
+
+// byte ring buffer whose memory is mapped twice, back to back in the virtual address space
+// bytes past the end of the ring show up again at its start -> every readable / writable span is contiguous,
+// a message that wraps around the end can still be used in place, no compaction or copies
+// single threaded, read and write indices only ever go up
+
+namespace Common {
+    class MirroredRing final {
+    public:
+        // size is rounded up to a power of two number of pages
+        explicit MirroredRing(size_t size) {
+            const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            size_ = page_size;
+            while(size_ < size) {
+                size_ <<= 1;
+            }
+            mask_ = size_ - 1;
+
+            const auto fd = memfd_create("mirrored_ring", MFD_CLOEXEC);
+            ASSERT(fd >= 0, "memfd_create() failed. error:" + string(strerror(errno)));
+            ASSERT(ftruncate(fd, size_) == 0, "ftruncate() failed for " + to_string(size_) + " bytes. error:" + string(strerror(errno)));
+
+            // reserve both halves first so nothing else can be mapped in between, then put the same pages in each half
+            auto base = mmap(nullptr, 2 * size_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            ASSERT(base != MAP_FAILED, "mmap() failed to reserve " + to_string(2 * size_) + " bytes. error:" + string(strerror(errno)));
+            data_ = static_cast<char *>(base);
+            ASSERT(mmap(data_, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+                   mmap(data_ + size_, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED,
+                   "mmap() failed to mirror " + to_string(size_) + " bytes. error:" + string(strerror(errno)));
+            // mappings keep the memory alive
+            close(fd);
+        }
+
+        ~MirroredRing() {
+            munmap(data_, 2 * size_);
+        }
+
+        auto size() const noexcept {
+            return size_;
+        }
+
+        // oldest unread byte, readable() bytes from here on are contiguous
+        auto readPtr() const noexcept -> char * {
+            return data_ + (read_index_ & mask_);
+        }
+
+        auto readable() const noexcept {
+            return static_cast<size_t>(write_index_ - read_index_);
+        }
+
+        // hands len read bytes back to the writer
+        auto consume(size_t len) noexcept {
+            read_index_ += len;
+        }
+
+        // first free byte, writable() bytes from here on are contiguous
+        auto writePtr() const noexcept -> char * {
+            return data_ + (write_index_ & mask_);
+        }
+
+        auto writable() const noexcept {
+            return size_ - readable();
+        }
+
+        // makes len bytes written at writePtr() readable
+        auto commit(size_t len) noexcept {
+            write_index_ += len;
+        }
+
+        MirroredRing() = delete;
+        MirroredRing(const MirroredRing &) = delete;
+        MirroredRing(const MirroredRing &&) = delete;
+        MirroredRing &operator=(const MirroredRing &) = delete;
+        MirroredRing &operator=(const MirroredRing &&) = delete;
+
+    private:
+        char *data_ = nullptr;
+        size_t size_ = 0;
+        size_t mask_ = 0;
+        uint64_t read_index_ = 0;
+        uint64_t write_index_ = 0;
+    };
+}
@@ -35,6 +35,8 @@ namespace Common {
         bool is_udp_ = false;
         bool is_listening_ = false; // is server or not
         bool needs_so_timestamp_ = false;
+        // listening sockets only, several sockets can listen on the same port and the kernel spreads connections over them
+        bool reuse_port_ = false;
 
         auto toString() const {
             std::stringstream ss;
@@ -44,6 +46,7 @@ namespace Common {
             << " is_udp:" << is_udp_
             << " is_listening:" << is_listening_
             << " needs_SO_timestamp:" << needs_so_timestamp_
+            << " reuse_port:" << reuse_port_
             << "]";
 
             return ss.str();
@@ -153,6 +156,10 @@ namespace Common {
             if(socket_cfg.is_listening_) {
                 ASSERT(setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<void *>(&one), sizeof(one))!=-1, "setsockopt() SO_REUSEADDR failed. errno:" + std::string(strerror(errno)));
             }
+            // has to be set on every one of the sockets before they bind
+            if(socket_cfg.is_listening_ && socket_cfg.reuse_port_) {
+                ASSERT(setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<void *>(&one), sizeof(one))!=-1, "setsockopt() SO_REUSEPORT failed. errno:" + std::string(strerror(errno)));
+            }
 
             // ip_ represents the address where you listen to if you are a server
             // ip_ represents the address of the server you want to connect to if you are a client
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+#include "macros.h"
+using namespace std;
+
+// Single producer single consumer variant of LFQueue, same interface
+// capacity is a power of 2 -> index wrap is a mask instead of %
+// producer and consumer indices live on seperate cache lines so the two threads do not false share
+// each side keeps a cached copy of the other side's index and only reloads it when the queue looks full / empty
+// indices only ever increase, slot = index & mask, no shared element counter -> no locked RMW instructions
+
+namespace Common {
+    constexpr size_t CACHE_LINE_SIZE = 64;
+
+    // Allocator -> backing storage for the elements, eg. HugePageAllocator, defaults to the heap
+    template<typename T, typename Allocator = allocator<T>>
+    class SPSCLFQueue final {
+        public:
+
+        // only takes size as param, has to be a power of 2
+        explicit SPSCLFQueue(size_t num_elems): store_(num_elems, T()), mask_(num_elems - 1) {
+            ASSERT(num_elems && !(num_elems & (num_elems - 1)), "SPSCLFQueue size must be a power of 2, size:" + to_string(num_elems));
+        }
+
+        // producer side
+        auto getNextToWriteTo() noexcept {
+            const auto write_index = producer_.write_index_.load(memory_order_relaxed);
+            if(UNLIKELY(write_index - producer_.cached_read_index_ == store_.size())) {
+                // looks full from our cached view, get the latest read index from the consumer
+                producer_.cached_read_index_ = consumer_.read_index_.load(memory_order_acquire);
+                ASSERT(write_index - producer_.cached_read_index_ != store_.size(), "SPSCLFQueue full, size:" + to_string(store_.size()));
+            }
+            // returns pointer to space at next write index
+            return &store_[write_index & mask_];
+        }
+
+        // publishes the element written at getNextToWriteTo() to the consumer
+        auto updateWriteIndex() noexcept {
+            producer_.write_index_.store(producer_.write_index_.load(memory_order_relaxed) + 1, memory_order_release);
+        }
+
+        // producer side, batch version
+        // reserves upto max_elems contiguous free slots starting at the next write index, count returned in num_elems
+        // can be less than asked for if the queue is nearly full or the slots wrap around the end of the store
+        auto getNextToWriteTo(size_t max_elems, size_t *num_elems) noexcept -> T * {
+            const auto write_index = producer_.write_index_.load(memory_order_relaxed);
+            if(store_.size() - (write_index - producer_.cached_read_index_) < max_elems) {
+                producer_.cached_read_index_ = consumer_.read_index_.load(memory_order_acquire);
+            }
+            const auto slot = write_index & mask_;
+            *num_elems = min({max_elems, store_.size() - (write_index - producer_.cached_read_index_), store_.size() - slot});
+            return &store_[slot];
+        }
+
+        // publishes num_elems elements written to the slots from the batch getNextToWriteTo() with a single store
+        auto updateWriteIndex(size_t num_elems) noexcept {
+            producer_.write_index_.store(producer_.write_index_.load(memory_order_relaxed) + num_elems, memory_order_release);
+        }
+
+        // consumer side
+        auto getNextToRead() const noexcept -> const T * {
+            const auto read_index = consumer_.read_index_.load(memory_order_relaxed);
+            if(read_index == consumer_.cached_write_index_) {
+                // looks empty from our cached view, get the latest write index from the producer
+                consumer_.cached_write_index_ = producer_.write_index_.load(memory_order_acquire);
+                if(read_index == consumer_.cached_write_index_) {
+                    // if the queue is empty there is nothing to consume
+                    return nullptr;
+                }
+            }
+            // returns pointer to actual element at next read index
+            return &store_[read_index & mask_];
+        }
+
+        // releases the element returned by getNextToRead() back to the producer
+        auto updateReadIndex() noexcept {
+            const auto read_index = consumer_.read_index_.load(memory_order_relaxed);
+            ASSERT(read_index != consumer_.cached_write_index_, "Read an invalid element in:" + std::to_string(pthread_self()));
+            consumer_.read_index_.store(read_index + 1, memory_order_release);
+        }
+
+        // consumer side, batch version
+        // returns upto max_elems contiguous ready elements starting at the next read index, count returned in num_elems
+        // nullptr if the queue is empty, stops at the end of the store so the span never wraps around
+        auto getNextToRead(size_t max_elems, size_t *num_elems) const noexcept -> const T * {
+            const auto read_index = consumer_.read_index_.load(memory_order_relaxed);
+            if(consumer_.cached_write_index_ - read_index < max_elems) {
+                consumer_.cached_write_index_ = producer_.write_index_.load(memory_order_acquire);
+            }
+            const auto slot = read_index & mask_;
+            *num_elems = min({max_elems, consumer_.cached_write_index_ - read_index, store_.size() - slot});
+            return (*num_elems ? &store_[slot] : nullptr);
+        }
+
+        // releases num_elems elements from the batch getNextToRead() back to the producer with a single store
+        auto updateReadIndex(size_t num_elems) noexcept {
+            const auto read_index = consumer_.read_index_.load(memory_order_relaxed);
+            ASSERT(num_elems <= consumer_.cached_write_index_ - read_index, "Read invalid elements in:" + std::to_string(pthread_self()));
+            consumer_.read_index_.store(read_index + num_elems, memory_order_release);
+        }
+
+        // number of elements, exact only when called from the producer or the consumer thread
+        auto size() const noexcept {
+            return producer_.write_index_.load(memory_order_acquire) - consumer_.read_index_.load(memory_order_acquire);
+        }
+
+        SPSCLFQueue() = delete;
+        SPSCLFQueue(const SPSCLFQueue &) = delete;
+        SPSCLFQueue(const SPSCLFQueue &&) = delete;
+        SPSCLFQueue &operator=(const SPSCLFQueue &) = delete;
+        SPSCLFQueue &operator=(const SPSCLFQueue &&) = delete;
+
+        private:
+
+        // written by the producer only
+        struct alignas(CACHE_LINE_SIZE) ProducerIndices {
+            atomic<size_t> write_index_ = {0};
+            size_t cached_read_index_ = 0;
+        };
+
+        // written by the consumer only, cached index is updated from getNextToRead() which is const
+        struct alignas(CACHE_LINE_SIZE) ConsumerIndices {
+            atomic<size_t> read_index_ = {0};
+            mutable size_t cached_write_index_ = 0;
+        };
+
+        // read only after construction, kept away from the index cache lines
+        alignas(CACHE_LINE_SIZE) vector<T, Allocator> store_; // memory pre allocated in vector
+        const size_t mask_;
+
+        ProducerIndices producer_;
+        ConsumerIndices consumer_;
+    };
+}
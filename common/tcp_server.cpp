@@ -12,23 +12,63 @@ namespace Common {
         epoll_event ev {
             // EPOLLET -> edge triggered mode notify only if new data arrives
             // EPOLLIN -> data arrived for read
-            EPOLLET | EPOLLIN,
+            // EPOLLOUT -> room in the kernel send buffer again, unblocks sockets whose last send() was short
+            EPOLLET | EPOLLIN | EPOLLOUT,
             {reinterpret_cast<void *>(socket)}
         };
         // add socket to monitoring list of epoll_fd_
         return !epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, socket->socket_fd_, &ev);
     }
 
-    auto TCPServer::listen(const string &iface, int port) -> void {
+    // dead sockets are dropped from both lists before the next sendAndRecv(), so this fires only once per socket
+    auto TCPServer::notifyIfDisconnected(TCPSocket *socket) noexcept -> void {
+        if(UNLIKELY(socket->socket_fd_ == -1) && disconnect_callback_) {
+            disconnect_callback_(socket);
+        }
+    }
+
+    // new socket for a connection accepted on the listener socket
+    auto TCPServer::acceptSocket(int fd) -> TCPSocket * {
+        // set socket configs
+        ASSERT(setNonBlocking(fd) && disableNagle(fd), "Failed to set non-blocking or no-delay on socket:" + to_string(fd));
+        logger_.log("%:% %() % accepted socket:%\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, fd);
+
+        // create a new socket and assign it the socket fd obtained from accept() call
+        auto socket = new TCPSocket(logger_, recv_buffer_size_, send_buffer_size_);
+        socket->socket_fd_ = fd;
+        socket->uses_epollout_ = (backend_ == TCPServerBackend::EPOLL);
+        // gets copy of server's recv_callback function
+        socket->recv_callback_ = recv_callback_;
+
+        // by default add it to receive sockets
+        receive_sockets_.push_back(socket);
+        return socket;
+    }
+
+    auto TCPServer::listen(const string &iface, int port, bool reuse_port) -> void {
+        // set the server, is_listening_ param = true, ip will be configured automatically
+        ASSERT(listener_socket_.connect("", iface, port, true, reuse_port) >= 0, "Listener socket failed to connect. iface:" + iface + " port:" + to_string(port) + " error:" + string(strerror(errno)));
+
+        if(backend_ == TCPServerBackend::IO_URING) {
+            uring_ = make_unique<IoUring>(TCPUringSqEntries, TCPUringCqEntries);
+            uring_->provideBuffers(UringBufferGroup, TCPUringNumBuffers, TCPUringBufferSize);
+            // accepts keep coming from this one request, goes to the kernel with the first poll()
+            uringArmAccept();
+            return;
+        }
+
         epoll_fd_ = epoll_create(1); // create epoll instance
         ASSERT(epoll_fd_ >= 0, "epoll_create() failed error:" + string(strerror(errno)));
-        // set the server, is_listening_ param = true, ip will be configured automatically
-        ASSERT(listener_socket_.connect("", iface, port, true) >= 0, "Listener socket failed to connect. iface:" + iface + " port:" + to_string(port) + " error:" + string(strerror(errno)));
         // our listening endpoint also has to be added to epoll list
         ASSERT(addToEpollList(&listener_socket_), "epoll_ctl() failed. error:" + string(strerror(errno)));
     }
 
     auto TCPServer::sendAndRecv() noexcept -> void {
+        if(backend_ == TCPServerBackend::IO_URING) {
+            uringSendAndRecv();
+            return;
+        }
+
         auto recv = false;
 
         // cleaning up dead sockets from recv sockets
@@ -36,30 +76,33 @@ namespace Common {
             return socket->socket_fd_ == -1;
         }), receive_sockets_.end());
 
-        for_each(receive_sockets_.begin(), receive_sockets_.end(), [&recv](auto socket){
+        // round robin, every socket reads atmost TCPReadQuantum and a different socket goes first each round
+        const auto num_receive_sockets = receive_sockets_.size();
+        const auto first_socket = (num_receive_sockets ? next_receive_socket_ % num_receive_sockets : 0);
+        for(size_t i = 0; i < num_receive_sockets; ++i) {
+            auto socket = receive_sockets_[(first_socket + i) % num_receive_sockets];
             // set recv to true if there is some data to read from some socket 
             recv |= socket->sendAndRecv();
-        });
+            notifyIfDisconnected(socket);
+        }
+        next_receive_socket_ = first_socket + 1;
         if (recv) {
             // finish callback only called when we read data
             recv_finished_callback_();
         }
-
-        // clean up dead sockets from send sockets
-        send_sockets_.erase(remove_if(send_sockets_.begin(), send_sockets_.end(), [](auto socket){
-            return socket->socket_fd_ == -1;
-        }), send_sockets_.end());
-
-        for_each(send_sockets_.begin(), send_sockets_.end(), [](auto socket) {
-            // send data to corresponding sockets
-            socket->sendAndRecv();
-        });
     }
 
     // checks which socket have activity and organizes them for processing 
     // at the given instance poll is called
     auto TCPServer::poll() noexcept -> void {
-        const int max_events = 1 + send_sockets_.size() + receive_sockets_.size();
+        if(backend_ == TCPServerBackend::IO_URING) {
+            // nothing to wait for, completions show up in the completion queue by themselves
+            // -> only enters the kernel for requests queued outside sendAndRecv(), eg. the accept from listen()
+            uring_->submit();
+            return;
+        }
+
+        const int max_events = 1 + receive_sockets_.size();
 
         // returns number of socket which have new eveents, populates events_ array
         // gets snapshot of activity at that instant
@@ -76,11 +119,11 @@ namespace Common {
                 // EPOLLIN -> the socket has data available for us to read
                 if(socket == &listener_socket_) {
                     // event at our listening socket -> new socket is trying to join us
-                    logger_.log("%:% %() % EPOLLIN listener_socket:%\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_), socket->socket_fd_);
+                    logger_.log("%:% %() % EPOLLIN listener_socket:%\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, socket->socket_fd_);
                     have_new_connection = true;
                     continue;
                 }
-                logger_.log("%:% %() % EPOLLIN socket:%\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_), socket->socket_fd_);
+                logger_.log("%:% %() % EPOLLIN socket:%\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, socket->socket_fd_);
                 // check if the socket is already in receive_sockets, if not, add to it 
                 if(find(receive_sockets_.begin(), receive_sockets_.end(), socket) == receive_sockets_.end()) {
                     receive_sockets_.push_back(socket);
@@ -88,48 +131,157 @@ namespace Common {
             }
             if(event.events & EPOLLOUT) {
                 // EPOLLOUT -> socket is ready to accept data from us
-                logger_.log("%:% %() % EPOLLOUT socket:%\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_), socket->socket_fd_);
-                // check is the socket is already in send_sockets, if not , add to it
-                if(find(send_sockets_.begin(), send_sockets_.end(), socket) == send_sockets_.end()) {
-                    send_sockets_.push_back(socket);
-                }
+                logger_.log("%:% %() % EPOLLOUT socket:%\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, socket->socket_fd_);
+                // every socket is in receive_sockets_, its next sendAndRecv() sends whatever queued up while it was blocked
+                socket->send_blocked_ = false;
             }
             if(event.events & (EPOLLERR | EPOLLHUP)) {
                 // there was an error condition or the socket hung up
-                logger_.log("%:% %() % EPOLLERR socket:%\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_), socket->socket_fd_);
+                logger_.log("%:% %() % EPOLLERR socket:%\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, socket->socket_fd_);
                 // still add to recieve sockets, recv will return false
                 if(find(receive_sockets_.begin(), receive_sockets_.end(), socket) == receive_sockets_.end()) {
                     receive_sockets_.push_back(socket);
                 }
             }
+        }
 
-            // keeps calling accept until it returns -1 
-            while(have_new_connection) {
-                logger_.log("%:% %() % have_new_connection\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_));
-                sockaddr_storage addr;
-                socklen_t addr_len = sizeof(addr);
-                // accept the new connection, from our listener socket file descriptor
-                // new socket fd, representing our connection with that client 
-                int fd = accept(listener_socket_.socket_fd_, reinterpret_cast<sockaddr *>(&addr), &addr_len);
-                if(fd == -1) break;
-
-                // set socket configs
-                ASSERT(setNonBlocking(fd) && disableNagle(fd), "Failed to set non-blocking or no-delay on socket:" + to_string(fd));
-                logger_.log("%:% %() % accepted socket:%\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_), fd);
-
-                // create a new socket and assign it the socket fd obtained from accept() call
-                auto socket = new TCPSocket(logger_);
-                socket->socket_fd_ = fd;
-                // gets copy of server's recv_callback function 
-                socket->recv_callback_ = recv_callback_;
-                // start monitoring this socket 
-                ASSERT(addToEpollList(socket), "Unable to add socket. error:" + std::string(std::strerror(errno)));
-
-                // by default add it to receive sockets
-                if(find(receive_sockets_.begin(), receive_sockets_.end(), socket) == receive_sockets_.end()){
-                    receive_sockets_.push_back(socket);
+        // keeps calling accept until it returns -1 
+        // after the event loop -> a listener event that is the last / only event still gets its connections accepted
+        while(have_new_connection) {
+            logger_.log("%:% %() % have_new_connection\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME);
+            sockaddr_storage addr;
+            socklen_t addr_len = sizeof(addr);
+            // accept the new connection, from our listener socket file descriptor
+            // new socket fd, representing our connection with that client 
+            int fd = accept(listener_socket_.socket_fd_, reinterpret_cast<sockaddr *>(&addr), &addr_len);
+            if(fd == -1) break;
+
+            auto socket = acceptSocket(fd);
+            // start monitoring this socket 
+            ASSERT(addToEpollList(socket), "Unable to add socket. error:" + std::string(std::strerror(errno)));
+        }
+    }
+
+    // io_uring backend
+
+    auto TCPServer::uringArmAccept() noexcept -> void {
+        auto sqe = uring_->getSqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listener_socket_.socket_fd_;
+        // one completion per accepted connection until the kernel drops the request
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->user_data = static_cast<uint64_t>(UringOp::ACCEPT);
+    }
+
+    auto TCPServer::uringArmRecv(TCPSocket *socket) noexcept -> void {
+        auto sqe = uring_->getSqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = socket->socket_fd_;
+        // one completion per received chunk, each one in a buffer the kernel picks from the group when the data arrives
+        // -> no memory sits reserved behind idle sockets
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = UringBufferGroup;
+        sqe->user_data = reinterpret_cast<uint64_t>(socket) | static_cast<uint64_t>(UringOp::RECV);
+    }
+
+    // one send of everything queued on the socket, the completion tells how much the kernel took
+    auto TCPServer::uringSend(TCPSocket *socket) noexcept -> void {
+        auto sqe = uring_->getSqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = socket->socket_fd_;
+        sqe->addr = reinterpret_cast<uint64_t>(socket->outbound_ring_.readPtr());
+        sqe->len = static_cast<uint32_t>(socket->outbound_ring_.readable());
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = reinterpret_cast<uint64_t>(socket) | static_cast<uint64_t>(UringOp::SEND);
+        socket->send_in_flight_ = true;
+    }
+
+    // only called once the socket's multishot recv is done, an in flight send keeps its own reference to the file
+    auto TCPServer::uringClose(TCPSocket *socket) noexcept -> void {
+        close(socket->socket_fd_);
+        socket->socket_fd_ = -1;
+    }
+
+    auto TCPServer::uringSendAndRecv() noexcept -> void {
+        auto recv = false;
+
+        // sockets closed in the last round, their pointers can still come back in completions of sends that were in flight
+        receive_sockets_.erase(remove_if(receive_sockets_.begin(), receive_sockets_.end(), [](auto socket){
+            return socket->socket_fd_ == -1;
+        }), receive_sockets_.end());
+
+        uring_->forEachCqe([this, &recv](const io_uring_cqe &cqe) {
+            auto socket = reinterpret_cast<TCPSocket *>(cqe.user_data & ~UringOpMask);
+            switch(static_cast<UringOp>(cqe.user_data & UringOpMask)) {
+                case UringOp::ACCEPT:
+                    if(cqe.res >= 0) {
+                        uringArmRecv(acceptSocket(cqe.res));
+                    } else {
+                        logger_.log("%:% %() % accept failed error:%\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, strerror(-cqe.res));
+                    }
+                    if(!(cqe.flags & IORING_CQE_F_MORE)) {
+                        uringArmAccept();
+                    }
+                    break;
+                case UringOp::RECV: {
+                    if(cqe.flags & IORING_CQE_F_BUFFER) {
+                        const auto buffer_id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                        const auto read_size = static_cast<size_t>(max(cqe.res, 0));
+                        if(UNLIKELY(read_size > socket->inbound_ring_.writable() && socket->socket_fd_ != -1)) {
+                            // the multishot recv cannot be held back like the epoll read, dropping the data would leave a gap in the stream
+                            // -> only this session ends, its recv completes with the shutdown and closes it the usual way
+                            socket->shutDown("recv buffer full, consumer not keeping up");
+                        } else if(LIKELY(read_size && socket->socket_fd_ != -1 && !socket->shut_down_)) {
+                            // one copy into the socket's ring -> recv_callback_ sees the same contiguous bytes as with epoll,
+                            // the buffer goes back to the kernel right away
+                            memcpy(socket->inbound_ring_.writePtr(), uring_->buffer(UringBufferGroup, buffer_id), read_size);
+                            socket->inbound_ring_.commit(read_size);
+                            // no SCM_TIMESTAMP on this path, the completion is seen here
+                            const auto rx_time = getCurrentNanos();
+                            logger_.log("%:% %() % read socket:% len:% utime:%\n", __FILE__, __LINE__, __FUNCTION__,
+                                        Common::LOG_TIME, socket->socket_fd_, socket->inbound_ring_.readable(), rx_time);
+                            socket->recv_callback_(socket, rx_time);
+                            recv = true;
+                        }
+                        uring_->recycleBuffer(UringBufferGroup, buffer_id);
+                    }
+                    if(UNLIKELY(socket->socket_fd_ == -1)) {
+                        break;
+                    }
+                    if(cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS)) {
+                        // peer closed the connection or the socket errored, the multishot recv is done as well
+                        logger_.log("%:% %() % socket:% disconnected or errored, res:%\n", __FILE__, __LINE__, __FUNCTION__,
+                                    Common::LOG_TIME, socket->socket_fd_, cqe.res);
+                        uringClose(socket);
+                        notifyIfDisconnected(socket);
+                    } else if(!(cqe.flags & IORING_CQE_F_MORE)) {
+                        // kernel dropped the request, eg. it ran out of provided buffers -> data waits in the socket until re-armed
+                        uringArmRecv(socket);
+                    }
+                    break;
                 }
+                case UringOp::SEND:
+                    socket->send_in_flight_ = false;
+                    if(cqe.res > 0) {
+                        socket->outbound_ring_.consume(cqe.res);
+                    }
+                    break;
+            }
+        });
+
+        if (recv) {
+            // finish callback only called when we read data
+            recv_finished_callback_();
+        }
+
+        // a send for every socket with queued data and none in flight
+        for(auto socket : receive_sockets_) {
+            if(socket->socket_fd_ != -1 && socket->outbound_ring_.readable() && !socket->send_in_flight_) {
+                uringSend(socket);
             }
         }
+        // sends and re-armed requests of all sockets in one io_uring_enter(), none if there are none
+        uring_->submit();
     }
 }
\ No newline at end of file
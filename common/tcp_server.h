@@ -1,13 +1,34 @@
 #pragma once 
 
+#include <memory>
+
 #include "tcp_socket.h"
+#include "io_uring.h"
 using namespace std;
 
 namespace Common {
+    // EPOLL -> readiness, poll() asks epoll which sockets can be read / written, sendAndRecv() does a recvmsg() / send() per socket
+    // IO_URING -> completions, one multishot accept and one multishot recv per socket stay armed in the kernel,
+    // received data lands in buffers shared by all sockets, sends of all sockets go to the kernel in one io_uring_enter()
+    enum class TCPServerBackend : int8_t {
+        EPOLL = 0,
+        IO_URING = 1
+    };
+
+    // io_uring backend, provided buffers shared by the receives of all sockets, each holds one completion's data
+    constexpr uint16_t TCPUringNumBuffers = 1024;
+    constexpr uint32_t TCPUringBufferSize = TCPReadQuantum;
+    constexpr uint32_t TCPUringSqEntries = 1024;
+    constexpr uint32_t TCPUringCqEntries = 8 * TCPUringSqEntries;
+
     struct TCPServer{
-        explicit TCPServer(Logger &logger): listener_socket_(logger), logger_(logger) {}
+        // accepted sockets get buffers of these sizes
+        explicit TCPServer(Logger &logger, size_t recv_buffer_size = TCPRecvBufferSize, size_t send_buffer_size = TCPSendBufferSize,
+                           TCPServerBackend backend = TCPServerBackend::EPOLL)
+        : recv_buffer_size_(recv_buffer_size), send_buffer_size_(send_buffer_size), backend_(backend), listener_socket_(logger), logger_(logger) {}
 
-        auto listen(const string &iface, int port) -> void;
+        // reuse_port -> other servers can listen on the same port, each gets its share of the new connections
+        auto listen(const string &iface, int port, bool reuse_port = false) -> void;
 
         auto poll() noexcept -> void;
 
@@ -16,18 +37,48 @@ namespace Common {
         private:
         auto addToEpollList(TCPSocket *socket);
 
+        auto notifyIfDisconnected(TCPSocket *socket) noexcept -> void;
+
+        auto acceptSocket(int fd) -> TCPSocket *;
+
+        // io_uring backend
+        // user_data of an sqe -> socket pointer with the kind of request in the low bits
+        enum class UringOp : uint64_t {
+            ACCEPT = 0,
+            RECV = 1,
+            SEND = 2
+        };
+        static constexpr uint64_t UringOpMask = 3;
+        static constexpr uint16_t UringBufferGroup = 0;
+
+        auto uringArmAccept() noexcept -> void;
+        auto uringArmRecv(TCPSocket *socket) noexcept -> void;
+        auto uringSend(TCPSocket *socket) noexcept -> void;
+        auto uringClose(TCPSocket *socket) noexcept -> void;
+        auto uringSendAndRecv() noexcept -> void;
+
 
         public:
+        const size_t recv_buffer_size_ = TCPRecvBufferSize;
+        const size_t send_buffer_size_ = TCPSendBufferSize;
+        const TCPServerBackend backend_ = TCPServerBackend::EPOLL;
+        // only created for TCPServerBackend::IO_URING
+        unique_ptr<IoUring> uring_;
+
         int epoll_fd_ = -1;
         // only job of listener socket is to accept new connections
         TCPSocket listener_socket_;
 
         epoll_event events_[1024];
-        vector<TCPSocket *> receive_sockets_, send_sockets_;
+        // every live accepted socket, each one receives and sends in sendAndRecv()
+        vector<TCPSocket *> receive_sockets_;
+        // receive socket that is read first in the next sendAndRecv(), moves by one every round
+        size_t next_receive_socket_ = 0;
         function<void(TCPSocket *s, Nanos rx_time)> recv_callback_ = nullptr;
         function<void()> recv_finished_callback_ = nullptr;
+        // called once when a connected socket is found to be disconnected or errored, socket is not used by the server after that
+        function<void(TCPSocket *s)> disconnect_callback_ = nullptr;
 
-        string time_str_;
         Logger &logger_;
     };
 }
\ No newline at end of file
@@ -3,7 +3,7 @@
 // function for basic socket functions -> send and receive
 
 namespace Common {
-    auto TCPSocket::connect(const string &ip, const string &iface, int port, bool is_listening) -> int {
+    auto TCPSocket::connect(const string &ip, const string &iface, int port, bool is_listening, bool reuse_port) -> int {
         // creates socket and returns socket fd
         // function called connect but works both for server and client 
         // in case of server it will bind and listen
@@ -14,7 +14,8 @@ namespace Common {
             port, 
             false, 
             is_listening,
-            true
+            true,
+            reuse_port
         };
         socket_fd_ = createSocket(logger_, socket_cfg);
 
@@ -33,8 +34,8 @@ namespace Common {
         auto cmsg = reinterpret_cast<struct cmsghdr *>(&ctrl); 
 
         // iov -> specifies where to read from, and maximum number of bytes that can be written 
-        // we are reading all the inbound data, hence size if the rest of the buffer
-        iovec iov{inbound_data_.data() + next_rcv_valid_index_, TCPBufferSize - next_rcv_valid_index_};
+        // reading atmost one quantum, bounded by the free space in the ring
+        iovec iov{inbound_ring_.writePtr(), min(inbound_ring_.writable(), TCPReadQuantum)};
         msghdr msg{ // message header with receive parameters
             &socket_attrib_,
             sizeof(socket_attrib_),
@@ -46,9 +47,10 @@ namespace Common {
 
         // reading data
         // if data is present, it is written to iov, metadata written to ctrl
-        const auto read_size = recvmsg(socket_fd_, &msg, MSG_DONTWAIT);
+        // full ring -> nothing is read this round, the consumer has to catch up first
+        const auto read_size = (LIKELY(iov.iov_len) ? recvmsg(socket_fd_, &msg, MSG_DONTWAIT) : 0);
         if(read_size > 0) {
-            next_rcv_valid_index_ += read_size;
+            inbound_ring_.commit(read_size);
             Nanos kernel_time = 0;
             timeval time_kernel;
             if(cmsg->cmsg_level == SOL_SOCKET &&
@@ -60,34 +62,55 @@ namespace Common {
             }
             const auto user_time = getCurrentNanos();
             logger_.log("%:% %() % read socket:% len:% utime:% ktime:% diff:%\n", __FILE__, __LINE__, __FUNCTION__,
-            Common::getCurrentTimeStr(&time_str_), socket_fd_, next_rcv_valid_index_, user_time, kernel_time, (user_time - kernel_time));
+            Common::LOG_TIME, socket_fd_, inbound_ring_.readable(), user_time, kernel_time, (user_time - kernel_time));
             // call the callback function, pass current socket 
             recv_callback_(this, kernel_time);
         }
 
         // handing EPOLLERRR / EPOLLHUP
-        if (read_size == 0 || (read_size < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        if ((read_size == 0 && iov.iov_len) || (read_size < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
              logger_.log("%:% %() % socket:% disconnected or errored, read_size:% errno:%\n", 
                     __FILE__, __LINE__, __FUNCTION__, 
-                    Common::getCurrentTimeStr(&time_str_), socket_fd_, read_size, strerror(errno));
+                    Common::LOG_TIME, socket_fd_, read_size, strerror(errno));
             close(socket_fd_);
             socket_fd_ = -1;
             return false;
         }
 
         // sending data 
-        if(next_send_valid_index_ > 0) {
-            // sending data from the start of the outbound data buffer to next send index
-            const auto n = ::send(socket_fd_, outbound_data_.data(), next_send_valid_index_, MSG_DONTWAIT | MSG_NOSIGNAL);
-            logger_.log("%:% %() % send socket:% len:%\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_), socket_fd_, n);
+        // everything queued since the last call goes out in this one send(), the mirror keeps it contiguous -> no writev() needed
+        if(outbound_ring_.readable() > 0 && !send_blocked_) {
+            // only what the kernel took is dropped from the ring, the rest goes with the next call
+            const auto n = ::send(socket_fd_, outbound_ring_.readPtr(), outbound_ring_.readable(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            logger_.log("%:% %() % send socket:% len:%\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, socket_fd_, n);
+            if(n > 0) {
+                outbound_ring_.consume(n);
+            }
+            // short send or EAGAIN -> kernel buffer is full, retrying before the peer reads would only burn syscalls
+            send_blocked_ = (uses_epollout_ && outbound_ring_.readable() > 0);
         }
-        next_send_valid_index_ = 0; // reset send index
         return (read_size > 0); // returns bool on whether data was read or not
     }
 
     // copies data to outbound buffer, does not send it yet
-    auto TCPSocket::send(const void *data, size_t len) noexcept -> void {
-        memcpy(outbound_data_.data() + next_send_valid_index_, data, len);
-        next_send_valid_index_+= len;
+    auto TCPSocket::send(const void *data, size_t len) noexcept -> bool {
+        if(UNLIKELY(shut_down_ || len > outbound_ring_.writable())) {
+            // dropping just this data would leave a gap in the stream -> the connection is ended instead
+            shutDown("send buffer full, peer not reading");
+            return false;
+        }
+        memcpy(outbound_ring_.writePtr(), data, len);
+        outbound_ring_.commit(len);
+        return true;
+    }
+
+    auto TCPSocket::shutDown(const char *reason) noexcept -> void {
+        if(shut_down_) {
+            return;
+        }
+        // shutdown() and not close(), the next read sees the end of the stream and the usual disconnect path closes the socket
+        logger_.log("%:% %() % socket:% %, shutting down\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, socket_fd_, reason);
+        shutdown(socket_fd_, SHUT_RDWR);
+        shut_down_ = true;
     }
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 
 #include "socket_utils.h"
 #include "logging.h"
+#include "mirrored_ring.h"
 using namespace std;
 
 // client, server terms only describe who initiates the connection 
@@ -11,21 +12,30 @@ using namespace std;
 // both can send and receive data 
 
 namespace Common {
-    constexpr size_t TCPBufferSize = 64 * 1024 * 1024; // 64 mb
+    // default per socket buffer sizes, a session costs these two and nothing else
+    constexpr size_t TCPRecvBufferSize = 256 * 1024;
+    constexpr size_t TCPSendBufferSize = 1024 * 1024;
+    // most bytes read from one socket per sendAndRecv(), rest stays in the kernel for the next round
+    // -> a flooding peer cannot take the whole pass from the other sockets
+    constexpr size_t TCPReadQuantum = 16 * 1024;
 
     struct TCPSocket {
         // constructor only initalizes the data buffers
         // actual socket created in connect function
-        explicit TCPSocket(Logger &logger) : logger_(logger) {
-            outbound_data_.resize(TCPBufferSize);
-            inbound_data_.resize(TCPBufferSize);
-        }
+        explicit TCPSocket(Logger &logger, size_t recv_buffer_size = TCPRecvBufferSize, size_t send_buffer_size = TCPSendBufferSize)
+        : inbound_ring_(recv_buffer_size), outbound_ring_(send_buffer_size), logger_(logger) {}
 
-        auto connect(const string &ip, const string &iface, int port, bool is_listening) -> int;
+        // reuse_port -> listening socket shares its port with others, see SocketCfg
+        auto connect(const string &ip, const string &iface, int port, bool is_listening, bool reuse_port = false) -> int;
 
         auto sendAndRecv() noexcept -> bool;
 
-        auto send(const void *data, size_t len) noexcept -> void;
+        // false -> outbound ring is full, the peer is not reading what it is sent
+        // nothing is queued and the connection is shut down, the owner sees it disconnect in one of the next sendAndRecv() calls
+        auto send(const void *data, size_t len) noexcept -> bool;
+
+        // ends the connection from this side when one of its rings cannot keep up with the peer, only the first call does anything
+        auto shutDown(const char *reason) noexcept -> void;
 
 
         TCPSocket() = delete;
@@ -35,17 +45,24 @@ namespace Common {
         TCPSocket &operator=(const TCPSocket &&) = delete;
 
         int socket_fd_ = -1;
-        vector<char> outbound_data_;
-        size_t next_send_valid_index_ = 0;
-        vector<char> inbound_data_;
-        size_t next_rcv_valid_index_ = 0;
+        // received bytes, recv_callback_ reads complete messages in place from readPtr() and consume()s them
+        // partial messages just stay, the mirror makes them contiguous once the rest arrives
+        MirroredRing inbound_ring_;
+        // bytes queued by send(), whatever the kernel does not take stays for the next sendAndRecv()
+        MirroredRing outbound_ring_;
+        // io_uring TCPServer only -> a send of outbound_ring_ bytes is with the kernel, the next one waits for its completion
+        bool send_in_flight_ = false;
+        // epoll TCPServer only -> the last send() found the kernel buffer full, no more send() calls until EPOLLOUT clears it
+        bool uses_epollout_ = false;
+        bool send_blocked_ = false;
+        // shutDown() was called, eg. by send() on a full outbound ring -> nothing more is queued or handed to recv_callback_
+        bool shut_down_ = false;
 
         // used as output param in recvmsg(), gets filled with info about whoever sent the data 
         struct sockaddr_in socket_attrib_{}; // store socket address information
         // user defined function when data arrives
         function<void(TCPSocket *s, Nanos rx_time)> recv_callback_ = nullptr;
 
-        string time_str_;
         Logger &logger_;
     };
 }
\ No newline at end of file
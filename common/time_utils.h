@@ -3,28 +3,158 @@
 #include <string>
 #include <chrono>
 #include <ctime>
-using namespace std; 
+#include <cstring>
+#include <algorithm>
+#include <x86intrin.h>
+#include <cpuid.h>
+
+#include "macros.h"
+using namespace std;
+
+// Wall clock nanos from the cpu timestamp counter, no syscall / vdso call on the hot path
+// tick rate measured once at startup against CLOCK_MONOTONIC_RAW
+// every thread re-anchors to CLOCK_REALTIME (at most once a second), which also re-measures the tick rate over the whole run -> drift stays bounded
+// a re-anchor never steps the clock, the gap to CLOCK_REALTIME is slewed away over the next interval -> time never goes backwards on a thread
+// falls back to clock_gettime() if the cpu does not have an invariant tsc
 
 namespace Common {
     typedef int64_t Nanos;
 
+    // 64x64 -> 128 bit products of the tick conversion, __extension__ keeps -Wpedantic quiet about __int128
+    __extension__ typedef __int128 Int128;
+    __extension__ typedef unsigned __int128 UInt128;
+
     constexpr Nanos NANOS_TO_MICROS = 1000;
     constexpr Nanos MICROS_TO_MILLIS = 1000;
     constexpr Nanos MILLIS_TO_SECS = 1000;
     constexpr Nanos NANOS_TO_MILLIS = NANOS_TO_MICROS * MICROS_TO_MILLIS;
     constexpr Nanos NANOS_TO_SECS = NANOS_TO_MILLIS * MILLIS_TO_SECS;
 
-    inline auto getCurrentNanos() noexcept {
-        return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    // how long the startup calibration busy waits for
+    constexpr Nanos TSC_CALIBRATION_NANOS = 10 * NANOS_TO_MILLIS;
+
+    // raw cpu timestamp counter, a few ns to read
+    // ticks, not nanos -> convert with tscToNanos()
+    inline auto rdtsc() noexcept -> uint64_t {
+        return __rdtsc();
     }
 
-    inline auto& getCurrentTimeStr(string* time_str) {
-        const auto time = chrono::system_clock::to_time_t(chrono::system_clock::now());
-        *time_str = ctime(&time);
-        if(!time_str->empty()) {
-            time_str->at(time_str->length()-1) = '\0';
+    inline auto clockNanos(clockid_t clock_id) noexcept -> Nanos {
+        timespec ts;
+        clock_gettime(clock_id, &ts);
+        return ts.tv_sec * NANOS_TO_SECS + ts.tv_nsec;
+    }
+
+    // invariant tsc -> ticks at a constant rate across frequency scaling and sleep states, and in sync across cores
+    inline auto hasInvariantTSC() noexcept {
+        unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+        if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+            return false;
+        }
+        return static_cast<bool>(edx & (1u << 8));
+    }
+
+    struct TSCCalibration {
+        bool invariant_ = false;
+        uint64_t tsc_ = 0; // tick and CLOCK_MONOTONIC_RAW reading taken at the same time
+        Nanos raw_nanos_ = 0;
+        uint64_t ticks_per_sec_ = 0;
+    };
+
+    inline auto calibrateTSC() noexcept {
+        TSCCalibration calibration;
+        calibration.invariant_ = hasInvariantTSC();
+        calibration.tsc_ = rdtsc();
+        calibration.raw_nanos_ = clockNanos(CLOCK_MONOTONIC_RAW);
+
+        uint64_t tsc = 0;
+        Nanos raw_nanos = 0;
+        do {
+            tsc = rdtsc();
+            raw_nanos = clockNanos(CLOCK_MONOTONIC_RAW);
+        } while(raw_nanos - calibration.raw_nanos_ < TSC_CALIBRATION_NANOS);
+        calibration.ticks_per_sec_ = static_cast<uint64_t>(static_cast<double>(tsc - calibration.tsc_) * NANOS_TO_SECS / (raw_nanos - calibration.raw_nanos_));
+        return calibration;
+    }
+
+    // measured once at program start
+    inline const TSCCalibration TSC_CALIBRATION = calibrateTSC();
+
+    // per thread, tick -> nanos is anchor_nanos_ + (tick - anchor_tsc_) * nanos_per_tick_ / 2^32
+    struct TSCAnchor {
+        uint64_t tsc_ = 0;
+        Nanos nanos_ = 0; // clock value at tsc_, CLOCK_REALTIME on the first anchor, continuous with the previous interval after that
+        uint64_t nanos_per_tick_ = 0; // fixed point, 32 fractional bits, tick rate plus the slew towards CLOCK_REALTIME
+        uint64_t next_anchor_tsc_ = 0; // 0 -> anchored on the first call from each thread
+    };
+
+    inline thread_local TSCAnchor tsc_anchor;
+
+    inline auto anchoredNanos(const TSCAnchor &anchor, uint64_t tsc) noexcept -> Nanos {
+        const auto ticks = static_cast<int64_t>(tsc - anchor.tsc_); // negative for ticks read before the anchor
+        return anchor.nanos_ + static_cast<Nanos>((static_cast<Int128>(ticks) * anchor.nanos_per_tick_) >> 32);
+    }
+
+    inline auto reanchorTSC() noexcept {
+        auto &anchor = tsc_anchor;
+        const auto tsc = rdtsc();
+        const auto realtime_nanos = clockNanos(CLOCK_REALTIME);
+        // tick rate over everything since startup, corrects the error of the short startup measurement as the run goes on
+        const auto raw_nanos = clockNanos(CLOCK_MONOTONIC_RAW);
+        const auto ticks = tsc - TSC_CALIBRATION.tsc_;
+        const auto nanos_per_tick = (raw_nanos - TSC_CALIBRATION.raw_nanos_ >= TSC_CALIBRATION_NANOS ?
+            static_cast<uint64_t>((static_cast<UInt128>(raw_nanos - TSC_CALIBRATION.raw_nanos_) << 32) / ticks) :
+            static_cast<uint64_t>((static_cast<UInt128>(NANOS_TO_SECS) << 32) / TSC_CALIBRATION.ticks_per_sec_));
+        // rate error shrinks as the run gets longer, so re-anchor after as long as has run so far, capped at a second
+        const auto interval_ticks = clamp(ticks, TSC_CALIBRATION.ticks_per_sec_ / 100, TSC_CALIBRATION.ticks_per_sec_);
+
+        if(UNLIKELY(!anchor.next_anchor_tsc_)) {
+            anchor.nanos_ = realtime_nanos;
+            anchor.nanos_per_tick_ = nanos_per_tick;
+        } else {
+            // carry on from where the last interval got to, and run fast or slow over the next one to meet CLOCK_REALTIME
+            // correction capped at half the interval -> the clock always moves forward, a large jump of CLOCK_REALTIME is caught up over several intervals
+            anchor.nanos_ = anchoredNanos(anchor, tsc);
+            const auto interval_nanos = static_cast<Nanos>((static_cast<UInt128>(interval_ticks) * nanos_per_tick) >> 32);
+            const auto correction = clamp(realtime_nanos - anchor.nanos_, -interval_nanos / 2, interval_nanos / 2);
+            anchor.nanos_per_tick_ = static_cast<uint64_t>((static_cast<UInt128>(interval_nanos + correction) << 32) / interval_ticks);
+        }
+        anchor.tsc_ = tsc;
+        anchor.next_anchor_tsc_ = tsc + interval_ticks;
+    }
+
+    // ticks from rdtsc(), possibly read on another thread -> wall clock nanos
+    inline auto tscToNanos(uint64_t tsc) noexcept -> Nanos {
+        if(UNLIKELY(tsc >= tsc_anchor.next_anchor_tsc_)) {
+            reanchorTSC();
+        }
+        return anchoredNanos(tsc_anchor, tsc);
+    }
+
+    inline auto getCurrentNanos() noexcept -> Nanos {
+        if(UNLIKELY(!TSC_CALIBRATION.invariant_)) {
+            return clockNanos(CLOCK_REALTIME);
+        }
+        return tscToNanos(rdtsc());
+    }
+
+    // ctime format of the time given in nanos, without the trailing newline
+    // formatted once per second per thread, every other call only copies the cached string
+    inline auto& nanosToTimeStr(Nanos nanos, string* time_str) {
+        thread_local time_t cached_secs = -1;
+        thread_local char cached_str[32] = {};
+        const auto secs = static_cast<time_t>(nanos / NANOS_TO_SECS);
+        if(secs != cached_secs) {
+            ctime_r(&secs, cached_str);
+            cached_str[24] = '\0'; // drop the trailing newline
+            cached_secs = secs;
         }
+        time_str->assign(cached_str, 24);
         return *time_str;
     }
 
-}
\ No newline at end of file
+    inline auto& getCurrentTimeStr(string* time_str) {
+        return nanosToTimeStr(getCurrentNanos(), time_str);
+    }
+
+}
@@ -10,10 +10,16 @@ namespace Common {
     constexpr size_t ME_MAX_TICKERS = 8;
     constexpr size_t ME_MAX_CLIENT_UPDATES = 256 * 1024;
     constexpr size_t ME_MAX_MARKET_UPDATES = 256 * 1024;
+    // max number of elements claimed from / reserved in a queue at once when draining or publishing bursts
+    constexpr size_t ME_QUEUE_BATCH_SIZE = 64;
 
     constexpr size_t ME_MAX_NUM_CLIENTS = 256;
     constexpr size_t ME_MAX_ORDER_IDS = 1024 * 1024;
     constexpr size_t ME_MAX_PRICE_LEVELS = 256;
+    // max number of matching engine threads, tickers are split between them
+    constexpr size_t ME_MAX_SHARDS = 8;
+    // how often a book in its call phase publishes the indicative auction price / volume, only if it changed
+    constexpr int64_t ME_AUCTION_INDICATIVE_INTERVAL_NANOS = 100 * 1000 * 1000;
 
     typedef uint64_t OrderId; 
     constexpr auto OrderId_INVALID = numeric_limits<OrderId>::max();
@@ -35,6 +41,11 @@ namespace Common {
         return to_string(ticker_id);
     }
 
+    // matching engine shard which owns all the books and orders of a ticker
+    inline auto tickerToShard(TickerId ticker_id, size_t num_shards) noexcept -> size_t {
+        return ticker_id % num_shards;
+    }
+
     typedef uint32_t ClientId;
     constexpr auto ClientId_INVALID = numeric_limits<ClientId>::max();
 
@@ -55,6 +66,10 @@ namespace Common {
         return to_string(price);
     }
 
+    // default price ladder for each orderbook -> [reference - band, reference + band] in ticks
+    constexpr Price ME_DEFAULT_PRICE_BAND = 32 * 1024;
+    constexpr Price ME_DEFAULT_REFERENCE_PRICE = ME_DEFAULT_PRICE_BAND;
+
     typedef uint32_t Qty;
     constexpr auto Qty_INVALID = numeric_limits<Qty>::max();
 
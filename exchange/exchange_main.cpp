@@ -7,7 +7,7 @@
 using namespace std;
 
 Common::Logger *logger = nullptr;
-Exchange::MatchingEngine *matching_engine = nullptr;
+array<Exchange::MatchingEngine *, ME_MAX_SHARDS> matching_engines = {};
 Exchange::MarketDataPublisher *market_data_publisher = nullptr;
 Exchange::OrderServer *order_server = nullptr;
 
@@ -17,8 +17,10 @@ void signal_handler(int) {
 
     delete logger;
     logger = nullptr;
-    delete matching_engine;
-    matching_engine = nullptr;
+    for(auto &matching_engine : matching_engines) {
+        delete matching_engine;
+        matching_engine = nullptr;
+    }
     delete market_data_publisher;
     market_data_publisher = nullptr;
     delete order_server;
@@ -34,29 +36,48 @@ int main(int, char **) {
     signal(SIGINT, signal_handler);
     const int sleep_time = 100 * 1000;
 
-    Exchange::ClientRequestLFQueue client_requests(ME_MAX_CLIENT_UPDATES);
-    Exchange::ClientResponseLFQueue client_responses(ME_MAX_CLIENT_UPDATES);
-    Exchange::MEMarketUpdateLFQueue market_updates(ME_MAX_MARKET_UPDATES);
+    // tickers are split over this many matching engine threads, each pinned to its core (-1 -> not pinned)
+    const size_t me_num_shards = 2;
+    const array<int, me_num_shards> me_shard_core_ids = {-1, -1};
+
+    // every shard has its own request, response and market update queues
+    Exchange::ClientRequestLFQueues client_requests = {};
+    Exchange::ClientResponseLFQueues client_responses = {};
+    Exchange::MEMarketUpdateLFQueues market_updates = {};
 
     string time_str;
 
-    // log 
-    matching_engine = new Exchange::MatchingEngine(&client_requests, &client_responses, &market_updates);
-    matching_engine->start();
+    for(size_t shard = 0; shard < me_num_shards; ++shard) {
+        client_requests[shard] = new Exchange::ClientRequestLFQueue(ME_MAX_CLIENT_UPDATES);
+        client_responses[shard] = new Exchange::ClientResponseLFQueue(ME_MAX_CLIENT_UPDATES);
+        market_updates[shard] = new Exchange::MEMarketUpdateLFQueue(ME_MAX_MARKET_UPDATES);
+
+        // log 
+        matching_engines[shard] = new Exchange::MatchingEngine(client_requests[shard], client_responses[shard], market_updates[shard],
+                                                               Exchange::MEOrderBookCfgHashMap{}, Exchange::MEShardCfg{shard, me_num_shards, me_shard_core_ids[shard]});
+        matching_engines[shard]->start();
+    }
 
     const string mkt_pub_iface = "lo";
     const string snap_pub_ip = "233.252.14.1", inc_pub_ip = "233.252.14.3";
     const int snap_pub_port = 20000, inc_pub_port = 20001;
 
     // log 
-    market_data_publisher = new Exchange::MarketDataPublisher(&market_updates, mkt_pub_iface, snap_pub_ip, snap_pub_port, inc_pub_ip, inc_pub_port);
+    market_data_publisher = new Exchange::MarketDataPublisher(market_updates, me_num_shards, mkt_pub_iface, snap_pub_ip, snap_pub_port, inc_pub_ip, inc_pub_port);
     market_data_publisher->start();
 
     const string order_gw_iface = "lo";
     const int order_gw_port = 12345;
+    // Common::TCPServerBackend::IO_URING -> completion based client sessions, needs a 6.0+ kernel
+    const auto order_gw_backend = Common::TCPServerBackend::EPOLL;
+    // > 0 -> client sessions spread over this many gateway threads, for when one core cannot keep up with every connected client
+    const size_t order_gw_num_gateways = 0;
+    // operator session allowed to start and uncross auctions, INVALID -> auctions cannot be driven over the wire
+    const auto order_gw_auction_control_client_id = Common::ClientId_INVALID;
 
     // log 
-    order_server = new Exchange::OrderServer(&client_requests, &client_responses, order_gw_iface, order_gw_port);
+    order_server = new Exchange::OrderServer(client_requests, client_responses, me_num_shards, order_gw_iface, order_gw_port,
+                                             Exchange::OMThrottleCfgHashMap{}, order_gw_backend, order_gw_num_gateways, order_gw_auction_control_client_id);
     order_server->start();
 
     while(true) {
@@ -1,8 +1,8 @@
 #include "market_data_publisher.h"
 
 namespace Exchange {
-    MarketDataPublisher::MarketDataPublisher(MEMarketUpdateLFQueue *market_updates, const string &iface, const string &snapshot_ip, int snapshot_port, const string &incremental_ip, int incremental_port)
-    : outgoing_md_updates_(market_updates), snapshot_md_updates_(ME_MAX_MARKET_UPDATES), run_(false), logger_("exchange_market_data_publisher.log"), incremental_socket_(logger_) {
+    MarketDataPublisher::MarketDataPublisher(const MEMarketUpdateLFQueues &market_updates, size_t num_shards, const string &iface, const string &snapshot_ip, int snapshot_port, const string &incremental_ip, int incremental_port)
+    : outgoing_md_updates_(market_updates), num_shards_(num_shards), snapshot_md_updates_(ME_MAX_MARKET_UPDATES), run_(false), logger_("exchange_market_data_publisher.log"), incremental_socket_(logger_) {
         // is listening set to false, because we are the producer in the multicast group
         ASSERT(incremental_socket_.init(incremental_ip, iface, incremental_port, false) >= 0, "");
         snapshot_synthesizer_ = new SnapshotSynthesizer(&snapshot_md_updates_, iface, snapshot_ip, snapshot_port);
@@ -11,28 +11,45 @@ namespace Exchange {
     auto MarketDataPublisher::run() noexcept -> void {
         // log 
         while(run_) {
-            for(auto market_update = outgoing_md_updates_->getNextToRead(); outgoing_md_updates_->size() && market_update; market_update = outgoing_md_updates_->getNextToRead()){
-                //log 
-                // constantly checks the outgoing_md_updates queue (if any data needs to be sent to market data consumer)
-                // send incremental updates to the clients with sequence number (udp connection)
-                // populates the outbound_data_ vector of our incremental socket
-                incremental_socket_.send(&next_inc_seq_num_, sizeof(next_inc_seq_num_));
-                incremental_socket_.send(market_update, sizeof(market_update));
-                // updating the read index
-                outgoing_md_updates_->updateReadIndex();
-
-                // updates the snapshot_updates queue (not sending data through tcp or udp)
-                // same info and sequence number shared
-                auto next_write= snapshot_md_updates_.getNextToWriteTo();
-                next_write->seq_num_= next_inc_seq_num_;
-                next_write->me_market_update_= *market_update;
-                snapshot_md_updates_.updateWriteIndex();
-
-                // finally the sequence number is updated
-                ++next_inc_seq_num_;
+            // round robin over the shards, each update gets the next global sequence number as it is merged in
+            for(size_t shard = 0; shard < num_shards_; ++shard) {
+                publishUpdates(outgoing_md_updates_[shard]);
             }
             // data from the outbound_data_ vector is actually sent to the clients 
             incremental_socket_.sendAndRecv();
         }
     }
-}
\ No newline at end of file
+
+    // publishes one burst of market updates from one shard, one read index update per burst
+    // only one burst at a time so a busy shard cannot hold back the updates of the others
+    auto MarketDataPublisher::publishUpdates(MEMarketUpdateLFQueue *outgoing_md_updates) noexcept -> void {
+        size_t num_updates = 0;
+        const auto market_updates = outgoing_md_updates->getNextToRead(ME_QUEUE_BATCH_SIZE, &num_updates);
+        if(market_updates) {
+            for(size_t i = 0; i < num_updates;) {
+                // reserve slots in the snapshot_updates queue for the rest of the burst (not sending data through tcp or udp)
+                size_t num_slots = 0;
+                auto next_write = snapshot_md_updates_.getNextToWriteTo(num_updates - i, &num_slots);
+                ASSERT(num_slots, "Snapshot MDPMarketUpdateLFQueue full");
+                for(size_t j = 0; j < num_slots; ++j, ++i) {
+                    const auto market_update = &market_updates[i];
+                    //log 
+                    // send incremental updates to the clients with sequence number (udp connection)
+                    // populates the outbound_data_ vector of our incremental socket
+                    incremental_socket_.send(&next_inc_seq_num_, sizeof(next_inc_seq_num_));
+                    incremental_socket_.send(market_update, sizeof(MEMarketUpdate));
+
+                    // same info and sequence number shared with the snapshot synthesizer
+                    next_write[j].seq_num_ = next_inc_seq_num_;
+                    next_write[j].me_market_update_ = *market_update;
+
+                    // finally the sequence number is updated
+                    ++next_inc_seq_num_;
+                }
+                snapshot_md_updates_.updateWriteIndex(num_slots);
+            }
+            // updating the read index once for the whole burst
+            outgoing_md_updates->updateReadIndex(num_updates);
+        }
+    }
+}
@@ -8,7 +8,8 @@ using namespace std;
 namespace Exchange {
     class MarketDataPublisher {
     public: 
-        MarketDataPublisher(MEMarketUpdateLFQueue *market_updates, const string &iface, const string &snapshot_ip, int snapshot_port, const string &incremental_ip, int incremental_port);
+        // one market update queue per matching engine shard, merged into a single incremental stream
+        MarketDataPublisher(const MEMarketUpdateLFQueues &market_updates, size_t num_shards, const string &iface, const string &snapshot_ip, int snapshot_port, const string &incremental_ip, int incremental_port);
 
         ~MarketDataPublisher() {
             stop();
@@ -30,11 +31,15 @@ namespace Exchange {
         }
 
         auto run() noexcept -> void;
+
+        auto publishUpdates(MEMarketUpdateLFQueue *outgoing_md_updates) noexcept -> void;
     
     private: 
         size_t next_inc_seq_num_ = 1;
         // incremental messages going to the clients through udp
-        MEMarketUpdateLFQueue *outgoing_md_updates_ = nullptr;
+        // one global sequence number across all the shards, every update of a ticker comes from the same shard so per ticker order is kept
+        MEMarketUpdateLFQueues outgoing_md_updates_;
+        const size_t num_shards_ = 1;
         // same information being sent to the snapshot synthesizer (will be read through the shared queue)
         MDPMarketUpdateLFQueue snapshot_md_updates_;
         
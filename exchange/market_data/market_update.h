@@ -1,8 +1,10 @@
 #pragma once 
 
 #include <sstream>
+#include <array>
 #include "common/types.h"
-#include "common/lf_queue.h"
+#include "common/spsc_lf_queue.h"
+#include "common/huge_page_allocator.h"
 
 using namespace std;
 using namespace Common; 
@@ -21,7 +23,9 @@ namespace Exchange {
         CANCEL = 4,
         TRADE = 5,
         SNAPSHOT_START = 6,
-        SNAPSHOT_END = 7
+        SNAPSHOT_END = 7,
+        // call phase only, price_ / qty_ -> price and volume the book would uncross at right now, Price_INVALID / 0 if not crossed
+        AUCTION_INDICATIVE = 8
     };
 
     inline string marketUpdateTypeToString(MarketUpdateType type) {
@@ -42,6 +46,8 @@ namespace Exchange {
                 return "SNAPSHOT_START";
             case MarketUpdateType::SNAPSHOT_END:
                 return "SNAPSHOT_END";
+            case MarketUpdateType::AUCTION_INDICATIVE:
+                return "AUCTION_INDICATIVE";
         }
         return "UNKOWN";
     }
@@ -94,7 +100,11 @@ namespace Exchange {
     };
 #pragma pack(pop)
     
-    typedef Common::LFQueue<Exchange::MEMarketUpdate> MEMarketUpdateLFQueue;
-    typedef Common::LFQueue<Exchange::MDPMarketUpdate> MDPMarketUpdateLFQueue;
+    // matching engine -> market data publisher and market data publisher -> snapshot synthesizer
+    // one producer and one consumer each
+    typedef Common::SPSCLFQueue<Exchange::MEMarketUpdate, Common::HugePageAllocator<Exchange::MEMarketUpdate>> MEMarketUpdateLFQueue;
+    // one queue per matching engine shard
+    typedef array<MEMarketUpdateLFQueue *, ME_MAX_SHARDS> MEMarketUpdateLFQueues;
+    typedef Common::SPSCLFQueue<Exchange::MDPMarketUpdate, Common::HugePageAllocator<Exchange::MDPMarketUpdate>> MDPMarketUpdateLFQueue;
 
 }
\ No newline at end of file
@@ -49,9 +49,10 @@ namespace Exchange {
                 ASSERT(order->order_id_ == me_market_update.order_id_, "");
                 ASSERT(order->side_ == me_market_update.side_, "");
 
-                // update the qty and price
+                // update the qty, price and priority, a modify can move the order to the back of a new price level
                 order->qty_ = me_market_update.qty_;
                 order->price_ = me_market_update.price_;
+                order->priority_ = me_market_update.priority_;
             }
             break;
             case MarketUpdateType::CANCEL: {
@@ -72,6 +73,7 @@ namespace Exchange {
             case MarketUpdateType::INVALID:
             case MarketUpdateType::SNAPSHOT_END:
             case MarketUpdateType::TRADE:
+            case MarketUpdateType::AUCTION_INDICATIVE:
             break;
         }
 
@@ -131,10 +133,13 @@ namespace Exchange {
     void SnapshotSynthesizer::run() {
         // log 
         while(run_) {
-            for(auto market_update = snapshot_md_updates_->getNextToRead(); snapshot_md_updates_->size() && market_update; market_update = snapshot_md_updates_->getNextToRead()){
-                // log 
-                addToSnapshot(market_update);
-                snapshot_md_updates_->updateReadIndex();
+            size_t num_updates = 0;
+            for(auto market_updates = snapshot_md_updates_->getNextToRead(ME_QUEUE_BATCH_SIZE, &num_updates); market_updates; market_updates = snapshot_md_updates_->getNextToRead(ME_QUEUE_BATCH_SIZE, &num_updates)){
+                for(size_t i = 0; i < num_updates; ++i) {
+                    // log 
+                    addToSnapshot(&market_updates[i]);
+                }
+                snapshot_md_updates_->updateReadIndex(num_updates);
             }
 
             if(getCurrentNanos() - last_snapshot_time_ > 60 * NANOS_TO_SECS) {
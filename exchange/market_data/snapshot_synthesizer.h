@@ -2,10 +2,11 @@
 
 #include "common/types.h"
 #include "common/thread_utils.h"
-#include "common/lf_queue.h"
+#include "common/spsc_lf_queue.h"
 #include "macros.h"
 #include "common/mcast_socket.h"
 #include "common/mem_pool.h"
+#include "common/huge_page_allocator.h"
 #include "common/logging.h"
 
 #include "market_data/market_update.h"
@@ -55,6 +56,6 @@ namespace Exchange {
         size_t last_inc_seq_num_ = 0;
         Nanos last_snapshot_time_ = 0;
 
-        MemPool<MEMarketUpdate> order_pool_;
+        MemPool<MEMarketUpdate, HugePageAllocator<MEMarketUpdate>> order_pool_;
     };
 }
\ No newline at end of file
@@ -3,14 +3,19 @@
 using namespace std;
 
 namespace Exchange {
-    MatchingEngine::MatchingEngine(ClientRequestLFQueue *client_requests, ClientResponseLFQueue *client_responses, MEMarketUpdateLFQueue *market_updates):
+    MatchingEngine::MatchingEngine(ClientRequestLFQueue *client_requests, ClientResponseLFQueue *client_responses, MEMarketUpdateLFQueue *market_updates, const MEOrderBookCfgHashMap &ticker_cfg, const MEShardCfg &shard_cfg, const MERiskCfgHashMap &risk_cfg):
+        shard_cfg_(shard_cfg),
         incoming_requests_(client_requests),
         outgoing_ogw_responses_(client_responses),
         outgoing_md_updates_(market_updates),
-        logger_("exchange_matching_engine.log") {
+        risk_gateway_(risk_cfg, shard_cfg.num_shards_),
+        logger_(shard_cfg.num_shards_ == 1 ? "exchange_matching_engine.log" : "exchange_matching_engine_" + to_string(shard_cfg.shard_id_) + ".log") {
+        ASSERT(shard_cfg.num_shards_ >= 1 && shard_cfg.num_shards_ <= ME_MAX_SHARDS && shard_cfg.shard_id_ < shard_cfg.num_shards_, "Invalid shard:" + to_string(shard_cfg.shard_id_) + " of:" + to_string(shard_cfg.num_shards_));
         // initially the orderbook is just an array of nullpointers (ME_MAX_TICKERS)
+        // only books for the tickers this shard owns are created
         for(size_t i=0; i<ticker_order_book_.size(); i++){
-            ticker_order_book_[i] = new MEOrderBook(i, &logger_, this);
+            ticker_order_book_[i] = (tickerToShard(i, shard_cfg.num_shards_) == shard_cfg.shard_id_ ? new MEOrderBook(i, ticker_cfg[i], &logger_, this) : nullptr);
+            num_auction_books_ += (ticker_order_book_[i] && ticker_order_book_[i]->inAuction());
         }
     }
 
@@ -36,7 +41,7 @@ namespace Exchange {
         // start matching engine on new thread
         run_ = true;
         // creates a new thread and the main event loop runs there: run()
-        ASSERT(Common::createAndStartThread(-1, "Exchange/MatchingEngine", [this](){run();}) != nullptr, "Failed to start MatchingEngine thread.");
+        ASSERT(Common::createAndStartThread(shard_cfg_.core_id_, "Exchange/MatchingEngine-" + to_string(shard_cfg_.shard_id_), [this](){run();}) != nullptr, "Failed to start MatchingEngine thread.");
     }
 
     auto MatchingEngine::stop() -> void {
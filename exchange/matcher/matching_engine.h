@@ -1,7 +1,7 @@
 #pragma once  
 
 #include "common/thread_utils.h"
-#include "common/lf_queue.h"
+#include "common/spsc_lf_queue.h"
 #include "common/macros.h"
 #include "common/logging.h"
 
@@ -10,15 +10,27 @@
 #include "market_data/market_update.h"
 
 #include "me_order_book.h"
+#include "me_risk_gateway.h"
 
 using namespace std;
 
 namespace Exchange {
+    // which part of the tickers a MatchingEngine serves, tickers are mapped to shards with tickerToShard()
+    // every shard runs on its own thread with its own books and queues, default -> single engine serving every ticker
+    struct MEShardCfg {
+        size_t shard_id_ = 0;
+        size_t num_shards_ = 1;
+        int core_id_ = -1; // core the shard thread is pinned to, -1 -> not pinned
+    };
+
     class MatchingEngine final {
     public:
         MatchingEngine(ClientRequestLFQueue *client_requests,
                        ClientResponseLFQueue *client_responses,
-                       MEMarketUpdateLFQueue *market_updates);
+                       MEMarketUpdateLFQueue *market_updates,
+                       const MEOrderBookCfgHashMap &ticker_cfg = MEOrderBookCfgHashMap{},
+                       const MEShardCfg &shard_cfg = MEShardCfg{},
+                       const MERiskCfgHashMap &risk_cfg = MERiskCfgHashMap{});
         ~MatchingEngine();
 
         auto start() -> void; 
@@ -32,18 +44,70 @@ namespace Exchange {
         MatchingEngine &operator=(const MatchingEngine &&) = delete;
 
         auto processClientRequest(const MEClientRequest *client_request) noexcept {
+            if(UNLIKELY(client_request->type_ == ClientRequestType::MASS_CANCEL && client_request->ticker_id_ == TickerId_INVALID)) {
+                // mass cancel across all the tickers this shard owns
+                for(auto order_book : ticker_order_book_) {
+                    if(order_book) {
+                        order_book->massCancel(client_request->client_id_, client_request->side_);
+                    }
+                }
+                return;
+            }
+
             // get the order book for mentioned ticker 
             auto order_book = ticker_order_book_[client_request->ticker_id_];
+            if(UNLIKELY(order_book == nullptr)) {
+                FATAL("Received request for ticker:" + tickerIdToString(client_request->ticker_id_) + " not owned by shard:" + to_string(shard_cfg_.shard_id_));
+            }
             switch(client_request->type_){
                 // process based on request for new order or cancel order
                 case ClientRequestType::NEW: {
-                    order_book->add(client_request->client_id_, client_request->order_id_, client_request->ticker_id_, client_request->side_, client_request->price_, client_request->qty_);
+                    order_book->add(client_request->client_id_, client_request->order_id_, client_request->ticker_id_, client_request->side_, client_request->price_, client_request->qty_,
+                                    client_request->display_qty_);
+                }
+                break;
+                case ClientRequestType::NEW_IOC:
+                case ClientRequestType::NEW_FOK: {
+                    order_book->addImmediate(client_request->client_id_, client_request->order_id_, client_request->ticker_id_, client_request->side_, client_request->price_, client_request->qty_,
+                                             client_request->type_ == ClientRequestType::NEW_FOK);
+                }
+                break;
+                case ClientRequestType::NEW_MARKET: {
+                    order_book->addImmediate(client_request->client_id_, client_request->order_id_, client_request->ticker_id_, client_request->side_, Price_INVALID, client_request->qty_, false);
+                }
+                break;
+                case ClientRequestType::NEW_STOP:
+                case ClientRequestType::NEW_STOP_LIMIT: {
+                    order_book->addStop(client_request->client_id_, client_request->order_id_, client_request->ticker_id_, client_request->side_,
+                                        (client_request->type_ == ClientRequestType::NEW_STOP_LIMIT ? client_request->price_ : Price_INVALID), client_request->stop_price_, client_request->qty_);
+                }
+                break;
+                case ClientRequestType::MODIFY: {
+                    order_book->modify(client_request->client_id_, client_request->order_id_, client_request->ticker_id_, client_request->price_, client_request->qty_);
+                }
+                break;
+                case ClientRequestType::MASS_CANCEL: {
+                    order_book->massCancel(client_request->client_id_, client_request->side_);
                 }
                 break;
                 case ClientRequestType::CANCEL: {
                     order_book->cancel(client_request->client_id_, client_request->order_id_, client_request->ticker_id_);
                 }
                 break;
+                case ClientRequestType::AUCTION_START: {
+                    if(!order_book->inAuction()) {
+                        order_book->startAuction();
+                        ++num_auction_books_;
+                    }
+                }
+                break;
+                case ClientRequestType::AUCTION_UNCROSS: {
+                    if(order_book->inAuction()) {
+                        order_book->uncross();
+                        --num_auction_books_;
+                    }
+                }
+                break;
                 default: {
                     FATAL("Received invalid client-request-type:" + clientRequestTypeToString(client_request->type_));
                 }
@@ -52,7 +116,8 @@ namespace Exchange {
         }
 
         auto sendClientResponse(const MEClientResponse *client_response) noexcept {
-            logger_.log("%:% %() % Sending %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_), client_response->toString());
+            risk_gateway_.onClientResponse(client_response);
+            logger_.log("%:% %() % Sending %\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, *client_response);
             // write to next available write index
             auto next_write = outgoing_ogw_responses_->getNextToWriteTo();
             // move to const reference so same as copy
@@ -62,34 +127,80 @@ namespace Exchange {
         }
 
         auto sendMarketUpdate(const MEMarketUpdate *market_update) noexcept {
-            logger_.log("%:% %() % Sending %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_), market_update->toString());
+            risk_gateway_.onMarketUpdate(market_update);
+            logger_.log("%:% %() % Sending %\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, *market_update);
             auto next_write = outgoing_md_updates_->getNextToWriteTo();
             *next_write = *market_update;
             outgoing_md_updates_->updateWriteIndex();
         }
 
+        // request failed the risk checks, never reaches the orderbook
+        auto sendRejected(const MEClientRequest *client_request, RejectReason reject_reason) noexcept {
+            const MEClientResponse client_response = {
+                ClientResponseType::REJECTED,
+                client_request->client_id_,
+                client_request->ticker_id_,
+                client_request->order_id_,
+                OrderId_INVALID,
+                client_request->side_,
+                client_request->price_,
+                Qty_INVALID,
+                client_request->qty_,
+                reject_reason
+            };
+            sendClientResponse(&client_response);
+        }
+
         auto run() noexcept {
-            logger_.log("%:% %() %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_));
+            logger_.log("%:% %() %\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME);
             while(run_) {
-                const auto me_client_request = incoming_requests_->getNextToRead(); 
-                if(LIKELY(me_client_request)) {
-                    logger_.log("%:% %() % Processing %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_),me_client_request->toString());
-                    processClientRequest(me_client_request);
-                    incoming_requests_->updateReadIndex();
+                // claim the whole burst of ready requests, release them with a single index update
+                size_t num_requests = 0;
+                const auto me_client_requests = incoming_requests_->getNextToRead(ME_QUEUE_BATCH_SIZE, &num_requests);
+                if(LIKELY(me_client_requests)) {
+                    // one clock read for the whole burst, only the rate limit needs it
+                    const auto now = getCurrentNanos();
+                    for(size_t i = 0; i < num_requests; ++i) {
+                        logger_.log("%:% %() % Processing %\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, me_client_requests[i]);
+                        const auto ticker_id = me_client_requests[i].ticker_id_;
+                        const auto reject_reason = risk_gateway_.check(&me_client_requests[i], now, (LIKELY(ticker_id < ME_MAX_TICKERS) ? ticker_order_book_[ticker_id] : nullptr));
+                        if(UNLIKELY(reject_reason != RejectReason::INVALID)) {
+                            sendRejected(&me_client_requests[i], reject_reason);
+                            continue;
+                        }
+                        processClientRequest(&me_client_requests[i]);
+                    }
+                    incoming_requests_->updateReadIndex(num_requests);
+                }
+
+                // clock is only read while some book is in its call phase
+                if(UNLIKELY(num_auction_books_) && getCurrentNanos() - last_indicative_time_ > ME_AUCTION_INDICATIVE_INTERVAL_NANOS) {
+                    last_indicative_time_ = getCurrentNanos();
+                    for(auto order_book : ticker_order_book_) {
+                        if(order_book && order_book->inAuction()) {
+                            order_book->publishIndicative();
+                        }
+                    }
                 }
             }
         }
 
     private:
+        const MEShardCfg shard_cfg_;
+        // nullptr for tickers owned by other shards
         OrderBookHashMap ticker_order_book_;
         ClientRequestLFQueue *incoming_requests_ = nullptr;
         ClientResponseLFQueue *outgoing_ogw_responses_ = nullptr;
         MEMarketUpdateLFQueue *outgoing_md_updates_ = nullptr;
+        // checked against every request before it reaches an orderbook, client-wide limits are split over the shards
+        MERiskGateway risk_gateway_;
+
+        // books in their call phase, indicative auction prices are published every ME_AUCTION_INDICATIVE_INTERVAL_NANOS while > 0
+        size_t num_auction_books_ = 0;
+        Nanos last_indicative_time_ = 0;
 
         // value always read from memory, no caching
         volatile bool run_ = false;
-
-        string time_str_;
         Logger logger_;
     };
 }
\ No newline at end of file
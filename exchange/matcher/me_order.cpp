@@ -12,6 +12,9 @@ namespace Exchange {
        << "price:" << priceToString(price_) << " "
        << "qty:" << qtyToString(qty_) << " "
        << "prio:" << priorityToString(priority_) << " "
+       << "display:" << qtyToString(display_qty_) << " "
+       << "reserve:" << qtyToString(reserve_qty_) << " "
+       << "stop:" << priceToString(stop_price_) << " "
        << "prev:" << orderIdToString(prev_order_ ? prev_order_->market_order_id_ : OrderId_INVALID) << " "
        << "next:" << orderIdToString(next_order_ ? next_order_->market_order_id_ : OrderId_INVALID) << "]";
 
@@ -8,9 +8,9 @@ using namespace std;
 using namespace Common; 
 
 // struct to define single order in orderbook
-// hashmap implented using array -> memory address used as keys (converted using index function)\
-// assign all space at once -> maybe sparse
-// hence we have pointers to prev and next entries 
+// orders at a price level (or waiting at the same stop price) are linked through prev and next pointers
+// orders of the same client are linked through prev and next client order pointers
+// client order id -> order lookup lives in me_order_index.h
 
 namespace Exchange {
     struct MEOrder {
@@ -22,14 +22,25 @@ namespace Exchange {
         OrderId market_order_id_ = OrderId_INVALID;
         Side side_ = Side::INVALID;
         Price price_ = Price_INVALID;
+        // shown qty, the only qty market data knows about
         Qty qty_ = Qty_INVALID;
         Priority priority_ = Priority_INVALID;
+        // iceberg peak size, qty_ is refilled up to it from reserve_qty_ when it trades down to 0
+        // Qty_INVALID -> plain order, reserve_qty_ stays 0
+        Qty display_qty_ = Qty_INVALID;
+        Qty reserve_qty_ = 0;
+        // set while a stop order waits in the stop book (not in the price levels), Price_INVALID otherwise
+        Price stop_price_ = Price_INVALID;
 
         // circular doubly linked list
         // points to prev and next order at the same price level 
         MEOrder *prev_order_ = nullptr;
         MEOrder *next_order_ = nullptr;
 
+        // non circular doubly linked list of all the live orders of client_id_ in this orderbook
+        MEOrder *prev_client_order_ = nullptr;
+        MEOrder *next_client_order_ = nullptr;
+
         MEOrder() = default; 
 
         MEOrder(TickerId ticker_id, ClientId client_id, OrderId client_order_id, OrderId market_order_id, Side side, Price price, Qty qty, Priority priority, MEOrder *prev_order, MEOrder *next_order) noexcept
@@ -39,14 +50,19 @@ namespace Exchange {
         auto toString() const -> string;
     };
 
-    typedef array<MEOrder *, ME_MAX_ORDER_IDS> OrderHashMap;
-    // 2d array, client -> array of order for that client 
-    typedef array<OrderHashMap, ME_MAX_NUM_CLIENTS> ClientOrderHashMap;
+    // bit of a client in MEOrdersAtPrice::client_mask_, clients share bits -> a set bit only means the client may have an order there
+    inline auto clientMaskBit(ClientId client_id) noexcept -> uint64_t {
+        return 1ull << (client_id % 64);
+    }
 
     // represent orders at the same price level 
     struct MEOrdersAtPrice {
         Side side_ = Side::INVALID;
         Price price_ = Price_INVALID;
+        // clientMaskBit() of every order added since the level was created, never cleared -> a hint, not an exact set
+        uint64_t client_mask_ = 0;
+        // shown + hidden qty of all the orders at the level, kept up to date so the auction never walks the orders
+        uint64_t total_qty_ = 0;
 
         // entry point to the best bid or ask at that price level 
         MEOrder *first_me_order_ = nullptr; 
@@ -2,28 +2,37 @@
 #include "matcher/matching_engine.h"
 
 namespace Exchange {
-    MEOrderBook::MEOrderBook(TickerId ticker_id, Logger *logger, MatchingEngine *matching_engine)
-    : ticker_id_(ticker_id), matching_engine_(matching_engine), logger_(logger), orders_at_price_pool_(ME_MAX_PRICE_LEVELS), order_pool_(ME_MAX_ORDER_IDS) {}
+    MEOrderBook::MEOrderBook(TickerId ticker_id, const MEOrderBookCfg &cfg, Logger *logger, MatchingEngine *matching_engine)
+    : ticker_id_(ticker_id), self_trade_prevention_(cfg.self_trade_prevention_),
+      matching_algorithm_(cfg.matching_algorithm_), lmm_client_id_(cfg.lmm_client_id_), lmm_allocation_percent_(cfg.lmm_allocation_percent_), reference_price_(cfg.reference_price_), matching_engine_(matching_engine), cid_oid_to_order_(ME_MAX_ORDER_IDS), orders_at_price_pool_(2 * (2 * cfg.price_band_ + 1)),
+      min_price_(cfg.reference_price_ - cfg.price_band_), max_price_(cfg.reference_price_ + cfg.price_band_),
+      bid_orders_at_price_(2 * cfg.price_band_ + 1, nullptr), ask_orders_at_price_(2 * cfg.price_band_ + 1, nullptr), bid_levels_(2 * cfg.price_band_ + 1), ask_levels_(2 * cfg.price_band_ + 1),
+      buy_stops_(2 * cfg.price_band_ + 1, nullptr), sell_stops_(2 * cfg.price_band_ + 1, nullptr), buy_stop_levels_(2 * cfg.price_band_ + 1), sell_stop_levels_(2 * cfg.price_band_ + 1),
+      order_pool_(ME_MAX_ORDER_IDS), in_auction_(cfg.opening_auction_), bid_depth_(2 * cfg.price_band_ + 1), ask_depth_(2 * cfg.price_band_ + 1), logger_(logger) {
+        ASSERT(cfg.price_band_ >= 0, "Invalid price band:" + to_string(cfg.price_band_) + " for ticker:" + tickerIdToString(ticker_id));
+        ASSERT(cfg.lmm_allocation_percent_ <= 100, "Invalid lmm allocation:" + to_string(cfg.lmm_allocation_percent_) + "% for ticker:" + tickerIdToString(ticker_id));
+    }
 
     MEOrderBook::~MEOrderBook() {
-        logger_->log("%:% %() % OrderBook\n%\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_),
+        logger_->log("%:% %() % OrderBook\n%\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME,
                 toString(false, true));
         // remove pointer to matching engine, set entry points to nullptr
         matching_engine_ = nullptr;
         bids_by_price_ = asks_by_price_ = nullptr;
-        for (auto &itr: cid_oid_to_order_) {
-            itr.fill(nullptr);
-        }
+        cid_oid_to_order_.clear();
     }
 
-    auto MEOrderBook::match(TickerId ticker_id, ClientId client_id, Side side, OrderId client_order_id, OrderId new_market_order_id, MEOrder *itr, Qty *leaves_qty) noexcept {
+    auto MEOrderBook::match(TickerId ticker_id, ClientId client_id, Side side, OrderId client_order_id, OrderId new_market_order_id, MEOrder *itr, Qty *leaves_qty, Qty max_fill_qty) noexcept {
         // fetch info of the order that is going to be filled
         const auto order = itr;
         const auto order_qty = order->qty_; 
-        const auto fill_qty = min(order_qty, *leaves_qty); 
+        const auto fill_qty = min({order_qty, *leaves_qty, max_fill_qty}); 
+        // a completely filled order goes back to the pool below, its price is read once up front
+        const auto trade_price = order->price_;
 
         // update the actuall qty that will be filled for both clients
         *leaves_qty -= fill_qty; 
+        reduceLevelQty(order, fill_qty);
         order->qty_ -= fill_qty;
 
         // send reponse to client who filled the order
@@ -34,7 +43,7 @@ namespace Exchange {
             client_order_id, 
             new_market_order_id, 
             side, 
-            itr->price_, 
+            trade_price, 
             fill_qty, 
             *leaves_qty
         };
@@ -48,9 +57,9 @@ namespace Exchange {
             order->client_order_id_,
             order->market_order_id_,
             order->side_,
-            itr->price_,
+            trade_price,
             fill_qty,
-            order->qty_
+            totalQty(order)
         };
         matching_engine_->sendClientResponse(&client_response_);
 
@@ -60,12 +69,16 @@ namespace Exchange {
             OrderId_INVALID,
             ticker_id,
             side,
-            itr->price_,
+            trade_price,
             fill_qty,
             Priority_INVALID
         };
         matching_engine_->sendMarketUpdate(&market_update_);
 
+        if(UNLIKELY(!order->qty_ && order->reserve_qty_)) {
+            refillPeak(order);
+        }
+
         if(!order->qty_) {
             // the order was completely filled
             market_update_ = {
@@ -92,41 +105,307 @@ namespace Exchange {
             };
             matching_engine_->sendMarketUpdate(&market_update_);
         }
+
+        last_trade_price_ = trade_price;
+        if(UNLIKELY(!buy_stop_levels_.empty() || !sell_stop_levels_.empty())) {
+            triggerStops(last_trade_price_);
+        }
     }
 
-    auto MEOrderBook::checkForMatch(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Qty qty, Qty new_market_order_id) noexcept {
+    auto MEOrderBook::preventSelfTrade(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, OrderId new_market_order_id, MEOrder *order, Qty *leaves_qty) noexcept -> void {
+        // market orders come in with marketPrice(), the client sent Price_INVALID
+        const auto client_price = (price == marketPrice(side) ? Price_INVALID : price);
+        auto cancel_newest = (self_trade_prevention_ == SelfTradePrevention::CANCEL_NEWEST || self_trade_prevention_ == SelfTradePrevention::CANCEL_BOTH);
+        auto cancel_oldest = (self_trade_prevention_ == SelfTradePrevention::CANCEL_OLDEST || self_trade_prevention_ == SelfTradePrevention::CANCEL_BOTH);
+
+        if(self_trade_prevention_ == SelfTradePrevention::DECREMENT) {
+            const auto order_qty = totalQty(order);
+            const auto decrement_qty = min(order_qty, *leaves_qty);
+            if(decrement_qty == order_qty) {
+                cancel_oldest = true;
+            } else {
+                // resting order keeps its priority, same as a MODIFY down in qty
+                const auto new_qty = order_qty - decrement_qty;
+                reduceLevelQty(order, decrement_qty);
+                order->qty_ = min(order->qty_, new_qty);
+                order->reserve_qty_ = new_qty - order->qty_;
+                client_response_ = {
+                    ClientResponseType::MODIFIED,
+                    order->client_id_,
+                    ticker_id,
+                    order->client_order_id_,
+                    order->market_order_id_,
+                    order->side_,
+                    order->price_,
+                    Qty_INVALID,
+                    new_qty
+                };
+                matching_engine_->sendClientResponse(&client_response_);
+                market_update_ = {
+                    MarketUpdateType::MODIFY,
+                    order->market_order_id_,
+                    ticker_id,
+                    order->side_,
+                    order->price_,
+                    order->qty_,
+                    order->priority_
+                };
+                matching_engine_->sendMarketUpdate(&market_update_);
+            }
+
+            if(decrement_qty == *leaves_qty) {
+                cancel_newest = true;
+            } else {
+                *leaves_qty -= decrement_qty;
+                client_response_ = {
+                    ClientResponseType::MODIFIED,
+                    client_id,
+                    ticker_id,
+                    client_order_id,
+                    new_market_order_id,
+                    side,
+                    client_price,
+                    Qty_INVALID,
+                    *leaves_qty
+                };
+                matching_engine_->sendClientResponse(&client_response_);
+            }
+        }
+
+        if(cancel_oldest) {
+            cancelOrder(order);
+        }
+        if(cancel_newest) {
+            sendCanceled(client_id, client_order_id, ticker_id, new_market_order_id, side, client_price, *leaves_qty);
+            *leaves_qty = 0;
+        }
+    }
+
+    auto MEOrderBook::preventAuctionSelfTrade(MEOrder *bid, MEOrder *ask) noexcept -> void {
+        // market order ids only go up -> the bigger one came in last
+        const auto newest = (bid->market_order_id_ > ask->market_order_id_ ? bid : ask);
+        const auto oldest = (newest == bid ? ask : bid);
+        auto cancel_newest = (self_trade_prevention_ == SelfTradePrevention::CANCEL_NEWEST || self_trade_prevention_ == SelfTradePrevention::CANCEL_BOTH);
+        auto cancel_oldest = (self_trade_prevention_ == SelfTradePrevention::CANCEL_OLDEST || self_trade_prevention_ == SelfTradePrevention::CANCEL_BOTH);
+
+        if(self_trade_prevention_ == SelfTradePrevention::DECREMENT) {
+            // both come down by the smaller one, which is canceled, the bigger one keeps its priority
+            const auto decrement_qty = min(totalQty(bid), totalQty(ask));
+            for(auto order : {oldest, newest}) {
+                const auto order_qty = totalQty(order);
+                if(decrement_qty == order_qty) {
+                    (order == oldest ? cancel_oldest : cancel_newest) = true;
+                    continue;
+                }
+                const auto new_qty = order_qty - decrement_qty;
+                reduceLevelQty(order, decrement_qty);
+                order->qty_ = min(order->qty_, new_qty);
+                order->reserve_qty_ = new_qty - order->qty_;
+                client_response_ = {
+                    ClientResponseType::MODIFIED,
+                    order->client_id_,
+                    order->ticker_id_,
+                    order->client_order_id_,
+                    order->market_order_id_,
+                    order->side_,
+                    order->price_,
+                    Qty_INVALID,
+                    new_qty
+                };
+                matching_engine_->sendClientResponse(&client_response_);
+                market_update_ = {
+                    MarketUpdateType::MODIFY,
+                    order->market_order_id_,
+                    order->ticker_id_,
+                    order->side_,
+                    order->price_,
+                    order->qty_,
+                    order->priority_
+                };
+                matching_engine_->sendMarketUpdate(&market_update_);
+            }
+        }
+
+        if(cancel_oldest) {
+            cancelOrder(oldest);
+        }
+        if(cancel_newest) {
+            cancelOrder(newest);
+        }
+    }
+
+    auto MEOrderBook::matchProRata(MEOrdersAtPrice *orders_at_price, ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, OrderId new_market_order_id, Qty *leaves_qty) noexcept -> bool {
+        const auto level_side = orders_at_price->side_;
+        const auto level_price = orders_at_price->price_;
+        if(UNLIKELY(self_trade_prevention_ != SelfTradePrevention::NONE && (orders_at_price->client_mask_ & clientMaskBit(client_id)))) {
+            // own orders are taken out of the allocation first, prevention can cancel them and even the whole level
+            level_orders_.clear();
+            auto order = orders_at_price->first_me_order_;
+            do {
+                if(order->client_id_ == client_id) {
+                    level_orders_.push_back(order);
+                }
+                order = order->next_order_;
+            } while(order != orders_at_price->first_me_order_);
+            for(size_t i = 0; i < level_orders_.size() && *leaves_qty; ++i) {
+                preventSelfTrade(client_id, client_order_id, ticker_id, side, price, new_market_order_id, level_orders_[i], leaves_qty);
+            }
+            orders_at_price = getOrdersAtPrice(level_side, level_price);
+            if(!*leaves_qty || !orders_at_price) {
+                return true;
+            }
+        }
+
+        // one walk over the list, everything after it works on the contiguous copies
+        level_orders_.clear();
+        level_qtys_.clear();
+        uint64_t level_qty = 0;
+        auto order = orders_at_price->first_me_order_;
+        do {
+            level_orders_.push_back(order);
+            level_qtys_.push_back(order->qty_);
+            level_qty += order->qty_;
+            order = order->next_order_;
+        } while(order != orders_at_price->first_me_order_);
+        if(*leaves_qty >= level_qty) {
+            // every order at the level is filled completely, same as price-time
+            return false;
+        }
+
+        // no dependency between the orders -> vectorizes
+        // scaled down a touch so the floating point rounding can only under allocate, never hand out more than leaves_qty
+        const auto num_orders = level_qtys_.size();
+        const auto qtys = level_qtys_.data();
+        const auto scale = static_cast<double>(*leaves_qty) / static_cast<double>(level_qty) * (1.0 - 1e-12);
+        uint64_t allocated_qty = 0;
+        for(size_t i = 0; i < num_orders; ++i) {
+            qtys[i] = static_cast<Qty>(static_cast<double>(qtys[i]) * scale);
+            allocated_qty += qtys[i];
+        }
+        // what rounding left over goes out a lot at a time in time priority
+        // leaves_qty < level_qty -> the orders always have room for it
+        for(size_t i = 0, rest_qty = *leaves_qty - allocated_qty; rest_qty; i = (i + 1 == num_orders ? 0 : i + 1)) {
+            if(qtys[i] < level_orders_[i]->qty_) {
+                ++qtys[i];
+                --rest_qty;
+            }
+        }
+
+        // an allocation can be an order's whole shown qty -> match() may fill and free it, or refill an iceberg to the back of the level
+        // safe since the walk is over the level_orders_ copy and each order is matched at most once, never touched after its match()
+        // leaves_qty < level_qty -> some order keeps qty, the level itself stays
+        for(size_t i = 0; i < num_orders; ++i) {
+            if(qtys[i]) {
+                match(ticker_id, client_id, side, client_order_id, new_market_order_id, level_orders_[i], leaves_qty, qtys[i]);
+            }
+        }
+        return true;
+    }
+
+    auto MEOrderBook::matchLMM(MEOrdersAtPrice *orders_at_price, ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, OrderId new_market_order_id, Qty *leaves_qty) noexcept -> bool {
+        if(LIKELY(!(orders_at_price->client_mask_ & clientMaskBit(lmm_client_id_))) || client_id == lmm_client_id_) {
+            return false;
+        }
+        auto lmm_qty = static_cast<Qty>(static_cast<uint64_t>(*leaves_qty) * lmm_allocation_percent_ / 100);
+        if(!lmm_qty) {
+            return false;
+        }
+
+        // fills can take orders off the level, so pick them out first
+        level_orders_.clear();
+        auto order = orders_at_price->first_me_order_;
+        do {
+            if(order->client_id_ == lmm_client_id_) {
+                level_orders_.push_back(order);
+            }
+            order = order->next_order_;
+        } while(order != orders_at_price->first_me_order_);
+
+        for(size_t i = 0; i < level_orders_.size() && lmm_qty; ++i) {
+            const auto fill_qty = min(level_orders_[i]->qty_, lmm_qty);
+            lmm_qty -= fill_qty;
+            match(ticker_id, client_id, side, client_order_id, new_market_order_id, level_orders_[i], leaves_qty, fill_qty);
+        }
+        return !level_orders_.empty();
+    }
+
+    template<MatchingAlgorithm algorithm>
+    auto MEOrderBook::matchOrder(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Qty qty, OrderId new_market_order_id) noexcept -> Qty {
         auto leaves_qty = qty; 
+        // 0 -> never matches a level's client_mask_, no self trade checks at all when prevention is off
+        const auto client_bit = (self_trade_prevention_ != SelfTradePrevention::NONE ? clientMaskBit(client_id) : 0);
+        // pro-rata / lmm allocation is done once when a level is reached, what it leaves over is matched in time priority
+        [[maybe_unused]] auto allocated_price = Price_INVALID;
 
         // keep filling the order as long as it is within the price range
         // return the remaining qty, so new order can be added in the orderbook if it is not zero
         if(side == Side::BUY){
             // iterate until you have leave qty and there are asks
             while(leaves_qty && asks_by_price_) {
-                // get the best ask
-                const auto ask_itr = asks_by_price_->first_me_order_;
                 // if no match, return leave qty as it is
-                if(LIKELY(price < ask_itr->price_)){
+                if(LIKELY(price < asks_by_price_->price_)){
                     break;
                 }
+                if constexpr(algorithm != MatchingAlgorithm::FIFO) {
+                    if(asks_by_price_->price_ != allocated_price) {
+                        allocated_price = asks_by_price_->price_;
+                        if(algorithm == MatchingAlgorithm::PRO_RATA ? matchProRata(asks_by_price_, client_id, client_order_id, ticker_id, side, price, new_market_order_id, &leaves_qty) :
+                                                                      matchLMM(asks_by_price_, client_id, client_order_id, ticker_id, side, new_market_order_id, &leaves_qty)) {
+                            continue;
+                        }
+                    }
+                }
+                // get the best ask, read after the level allocation which can take orders off the level
+                const auto ask_itr = asks_by_price_->first_me_order_;
+                // per order check only at levels the client may have orders at
+                if(UNLIKELY((asks_by_price_->client_mask_ & client_bit) && ask_itr->client_id_ == client_id)) {
+                    preventSelfTrade(client_id, client_order_id, ticker_id, side, price, new_market_order_id, ask_itr, &leaves_qty);
+                    continue;
+                }
                 match(ticker_id, client_id, side, client_order_id, new_market_order_id, ask_itr, &leaves_qty);
             }
         }
         if(side == Side::SELL) {
             // iterate until you have leave qty and there are bids
             while(leaves_qty && bids_by_price_) {
-                // get the best bid
-                const auto bid_itr = bids_by_price_->first_me_order_;
                 // if not match, return leave qty as it is
-                if(LIKELY(price > bid_itr->price_)) {
+                if(LIKELY(price > bids_by_price_->price_)) {
                     break;
                 }
+                if constexpr(algorithm != MatchingAlgorithm::FIFO) {
+                    if(bids_by_price_->price_ != allocated_price) {
+                        allocated_price = bids_by_price_->price_;
+                        if(algorithm == MatchingAlgorithm::PRO_RATA ? matchProRata(bids_by_price_, client_id, client_order_id, ticker_id, side, price, new_market_order_id, &leaves_qty) :
+                                                                      matchLMM(bids_by_price_, client_id, client_order_id, ticker_id, side, new_market_order_id, &leaves_qty)) {
+                            continue;
+                        }
+                    }
+                }
+                // get the best bid
+                const auto bid_itr = bids_by_price_->first_me_order_;
+                if(UNLIKELY((bids_by_price_->client_mask_ & client_bit) && bid_itr->client_id_ == client_id)) {
+                    preventSelfTrade(client_id, client_order_id, ticker_id, side, price, new_market_order_id, bid_itr, &leaves_qty);
+                    continue;
+                }
                 match(ticker_id, client_id, side, client_order_id, new_market_order_id, bid_itr, &leaves_qty);
             }
         }
         return leaves_qty;
     }
 
-    auto MEOrderBook::add(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Qty qty) noexcept -> void {
+    auto MEOrderBook::checkForMatch(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Qty qty, Qty new_market_order_id) noexcept {
+        // one well predicted branch per incoming order, nothing per order matched
+        switch(matching_algorithm_) {
+            case MatchingAlgorithm::PRO_RATA:
+                return matchOrder<MatchingAlgorithm::PRO_RATA>(client_id, client_order_id, ticker_id, side, price, qty, new_market_order_id);
+            case MatchingAlgorithm::LMM:
+                return matchOrder<MatchingAlgorithm::LMM>(client_id, client_order_id, ticker_id, side, price, qty, new_market_order_id);
+            default:
+                return matchOrder<MatchingAlgorithm::FIFO>(client_id, client_order_id, ticker_id, side, price, qty, new_market_order_id);
+        }
+    }
+
+    auto MEOrderBook::add(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Qty qty, Qty display_qty) noexcept -> void {
         const auto new_market_order_id = generateNewMarketOrderId(); 
         // send immediate acknowledgment to client, that their order was accepted
         client_response_ = {
@@ -140,38 +419,241 @@ namespace Exchange {
             qty
         };
         matching_engine_->sendClientResponse(&client_response_);
-        // check how much quantity is remaining after matching
-        const auto leaves_qty = checkForMatch(client_id, client_order_id, ticker_id, side, price, qty, new_market_order_id);
+        // check how much quantity is remaining after matching, nothing matches during the call phase
+        const auto leaves_qty = (LIKELY(!in_auction_) ? checkForMatch(client_id, client_order_id, ticker_id, side, price, qty, new_market_order_id) : qty);
 
         if(LIKELY(leaves_qty)) {
+            if(UNLIKELY(!priceInBand(price))) {
+                // price is outside of the price ladder, remaining qty cannot rest in the orderbook -> cancel it
+                sendCanceled(client_id, client_order_id, ticker_id, new_market_order_id, side, price, leaves_qty);
+                runTriggeredStops();
+                return;
+            }
+
             // some quantity yet to be filled 
-            const auto priority = getNextPriority(price);
+            const auto priority = getNextPriority(side, price);
             // create new passive order and add that to the orderbook 
             auto order = order_pool_.allocate(ticker_id, client_id, client_order_id, new_market_order_id, side, price, leaves_qty, priority, nullptr, nullptr);
+            // a zero peak could never be refilled, treated as a plain order
+            order->display_qty_ = (display_qty && display_qty < qty ? display_qty : Qty_INVALID);
+            setRestingQty(order, leaves_qty);
             addOrder(order);
 
-            // send market update that an order has been added 
+            // send market update that an order has been added, only with the shown qty
             market_update_ = {
                 MarketUpdateType::ADD,
                 new_market_order_id,
                 ticker_id,
                 side,
                 price,
-                leaves_qty,
+                order->qty_,
                 priority
             };
             matching_engine_->sendMarketUpdate(&market_update_);
         }
+        // stops hit by the trades of this order go right after it
+        runTriggeredStops();
+    }
+
+    auto MEOrderBook::addImmediate(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Qty qty, bool fill_or_kill) noexcept -> void {
+        const auto new_market_order_id = generateNewMarketOrderId();
+        client_response_ = {
+            ClientResponseType::ACCEPTED,
+            client_id,
+            ticker_id,
+            client_order_id,
+            new_market_order_id,
+            side,
+            price, 0,
+            qty
+        };
+        matching_engine_->sendClientResponse(&client_response_);
+
+        if(UNLIKELY(in_auction_)) {
+            // nothing trades before the uncross, an immediate order could only be canceled later
+            sendCanceled(client_id, client_order_id, ticker_id, new_market_order_id, side, price, qty);
+            return;
+        }
+
+        // market order -> most aggressive limit price for that side
+        const auto limit_price = (price != Price_INVALID ? price : marketPrice(side));
+        if(fill_or_kill && availableQty(client_id, side, limit_price, qty) < qty) {
+            // not enough liquidity, nothing is filled
+            sendCanceled(client_id, client_order_id, ticker_id, new_market_order_id, side, price, qty);
+            return;
+        }
+
+        const auto leaves_qty = checkForMatch(client_id, client_order_id, ticker_id, side, limit_price, qty, new_market_order_id);
+        if(leaves_qty) {
+            sendCanceled(client_id, client_order_id, ticker_id, new_market_order_id, side, price, leaves_qty);
+        }
+        runTriggeredStops();
+    }
+
+    auto MEOrderBook::addStop(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Price stop_price, Qty qty) noexcept -> void {
+        const auto new_market_order_id = generateNewMarketOrderId();
+        client_response_ = {
+            ClientResponseType::ACCEPTED,
+            client_id,
+            ticker_id,
+            client_order_id,
+            new_market_order_id,
+            side,
+            price, 0,
+            qty
+        };
+        matching_engine_->sendClientResponse(&client_response_);
+
+        if(UNLIKELY(!priceInBand(stop_price))) {
+            // stop book uses the same ladder as the price levels, a stop price outside of it can never be held
+            sendCanceled(client_id, client_order_id, ticker_id, new_market_order_id, side, price, qty);
+            return;
+        }
+
+        // not in the price levels -> no priority and no market update until it triggers
+        auto order = order_pool_.allocate(ticker_id, client_id, client_order_id, new_market_order_id, side, price, qty, Priority_INVALID, nullptr, nullptr);
+        order->stop_price_ = stop_price;
+        linkStopOrder(order);
+        indexOrder(order);
+
+        if(last_trade_price_ != Price_INVALID && LIKELY(!in_auction_)) {
+            triggerStops(last_trade_price_);
+            runTriggeredStops();
+        }
+    }
+
+    auto MEOrderBook::triggerStops(Price trade_price) noexcept -> void {
+        // moves all the stops waiting at one stop price, in the order they came in
+        auto trigger = [this](MEOrder *&first_order, LevelBitmap &levels, size_t index) {
+            auto order = first_order;
+            do {
+                const auto next_order = order->next_order_;
+                order->prev_order_ = order->next_order_ = nullptr;
+                (triggered_stops_tail_ ? triggered_stops_tail_->next_order_ : triggered_stops_head_) = order;
+                triggered_stops_tail_ = order;
+                order = next_order;
+            } while(order != first_order);
+            first_order = nullptr;
+            levels.clear(index);
+        };
+
+        // trade prices are always inside the ladder, they come from resting orders
+        const auto trade_index = priceToIndex(trade_price);
+        // buy stops trigger at trade price >= stop price, lowest stop price first
+        for(auto index = buy_stop_levels_.first(); index != LevelBitmap::NPOS && index <= trade_index; index = buy_stop_levels_.findNext(index + 1)) {
+            trigger(buy_stops_[index], buy_stop_levels_, index);
+        }
+        // sell stops trigger at trade price <= stop price, highest stop price first
+        for(auto index = sell_stop_levels_.last(); index != LevelBitmap::NPOS && index >= trade_index; index = (index ? sell_stop_levels_.findPrev(index - 1) : LevelBitmap::NPOS)) {
+            trigger(sell_stops_[index], sell_stop_levels_, index);
+        }
+    }
+
+    auto MEOrderBook::runTriggeredStops() noexcept -> void {
+        while(triggered_stops_head_) {
+            auto order = triggered_stops_head_;
+            triggered_stops_head_ = order->next_order_;
+            if(!triggered_stops_head_) {
+                triggered_stops_tail_ = nullptr;
+            }
+            order->next_order_ = nullptr;
+            order->stop_price_ = Price_INVALID;
+
+            client_response_ = {
+                ClientResponseType::TRIGGERED,
+                order->client_id_,
+                order->ticker_id_,
+                order->client_order_id_,
+                order->market_order_id_,
+                order->side_,
+                order->price_,
+                Qty_INVALID,
+                order->qty_
+            };
+            matching_engine_->sendClientResponse(&client_response_);
+
+            // trades in here only queue more stops behind this one
+            const auto leaves_qty = checkForMatch(order->client_id_, order->client_order_id_, order->ticker_id_, order->side_,
+                                                  (order->price_ != Price_INVALID ? order->price_ : marketPrice(order->side_)), order->qty_, order->market_order_id_);
+            if(leaves_qty && order->price_ != Price_INVALID && priceInBand(order->price_)) {
+                // stop limit rests with what is left, same MEOrder and index entry
+                order->qty_ = leaves_qty;
+                order->priority_ = getNextPriority(order->side_, order->price_);
+                linkOrder(order);
+                market_update_ = {
+                    MarketUpdateType::ADD,
+                    order->market_order_id_,
+                    order->ticker_id_,
+                    order->side_,
+                    order->price_,
+                    order->qty_,
+                    order->priority_
+                };
+                matching_engine_->sendMarketUpdate(&market_update_);
+                continue;
+            }
+
+            if(leaves_qty) {
+                sendCanceled(order->client_id_, order->client_order_id_, order->ticker_id_, order->market_order_id_, order->side_, order->price_, leaves_qty);
+            }
+            unindexOrder(order);
+            order_pool_.deallocate(order);
+        }
+    }
+
+    auto MEOrderBook::availableQty(ClientId client_id, Side side, Price price, Qty qty) const noexcept -> Qty {
+        uint64_t available_qty = 0; // wider than Qty, the sum goes past qty by atmost one order
+        // own orders never trade with an incoming order once prevention is on
+        // CANCEL_OLDEST cancels them and keeps matching -> skipped, every other mode ends or shrinks the incoming order there -> counting stops
+        const auto prevent_self_trade = (self_trade_prevention_ != SelfTradePrevention::NONE);
+        const auto stops_at_own_order = (prevent_self_trade && self_trade_prevention_ != SelfTradePrevention::CANCEL_OLDEST);
+        const auto best_orders_at_price = (side == Side::BUY ? asks_by_price_ : bids_by_price_);
+        for(auto orders_at_price = best_orders_at_price; orders_at_price && available_qty < qty;) {
+            if(side == Side::BUY ? price < orders_at_price->price_ : price > orders_at_price->price_) {
+                break;
+            }
+            const auto has_own_orders = (prevent_self_trade && (orders_at_price->client_mask_ & clientMaskBit(client_id)));
+            // pro-rata deals with own orders before allocating anything at the level -> an own order anywhere in it counts, price-time only gets to the orders ahead
+            const auto own_orders_first = (has_own_orders && stops_at_own_order && matching_algorithm_ == MatchingAlgorithm::PRO_RATA);
+            const auto level_start_qty = available_qty;
+            auto order = orders_at_price->first_me_order_;
+            do {
+                if(UNLIKELY(has_own_orders && order->client_id_ == client_id)) {
+                    if(stops_at_own_order) {
+                        return static_cast<Qty>(min<uint64_t>(own_orders_first ? level_start_qty : available_qty, qty));
+                    }
+                } else {
+                    available_qty += totalQty(order); // hidden reserve trades at this price too
+                }
+                order = order->next_order_;
+            } while((available_qty < qty || own_orders_first) && order != orders_at_price->first_me_order_);
+            orders_at_price = (orders_at_price->next_entry_ == best_orders_at_price ? nullptr : orders_at_price->next_entry_);
+        }
+        return static_cast<Qty>(min<uint64_t>(available_qty, qty));
+    }
+
+    auto MEOrderBook::sendCanceled(ClientId client_id, OrderId client_order_id, TickerId ticker_id, OrderId market_order_id, Side side, Price price, Qty leaves_qty) noexcept -> void {
+        client_response_ = {
+            ClientResponseType::CANCELED,
+            client_id,
+            ticker_id,
+            client_order_id,
+            market_order_id,
+            side,
+            price,
+            Qty_INVALID,
+            leaves_qty
+        };
+        matching_engine_->sendClientResponse(&client_response_);
     }
 
     auto MEOrderBook::cancel(ClientId client_id, OrderId order_id, TickerId ticker_id) noexcept -> void {
         // check for valid client id
-        auto is_cancelable = (client_id < cid_oid_to_order_.size()); 
+        auto is_cancelable = (client_id < ME_MAX_NUM_CLIENTS); 
         MEOrder *exchange_order = nullptr; 
         if(LIKELY(is_cancelable)) {
             // check if the order is valid 
-            auto &co_itr = cid_oid_to_order_.at(client_id);
-            exchange_order = co_itr.at(order_id);
+            exchange_order = cid_oid_to_order_.find(client_id, order_id);
             is_cancelable = (exchange_order != nullptr);
         }
         if(UNLIKELY(!is_cancelable)) {
@@ -187,32 +669,329 @@ namespace Exchange {
                 Qty_INVALID,
                 Qty_INVALID
             };
-        } else {
-            // successful cancel, send market update and client update 
+            matching_engine_->sendClientResponse(&client_response_);
+            return;
+        }
+        cancelOrder(exchange_order);
+    }
+
+    auto MEOrderBook::cancelOrder(MEOrder *order) noexcept -> void {
+        if(UNLIKELY(order->stop_price_ != Price_INVALID)) {
+            // stop that has not triggered, never published -> only the client hears about it
+            sendCanceled(order->client_id_, order->client_order_id_, order->ticker_id_, order->market_order_id_, order->side_, order->price_, order->qty_);
+            unlinkStopOrder(order);
+            unindexOrder(order);
+            order_pool_.deallocate(order);
+            return;
+        }
+        // successful cancel, send market update and client update 
+        client_response_ = {
+            ClientResponseType::CANCELED,
+            order->client_id_,
+            order->ticker_id_,
+            order->client_order_id_,
+            order->market_order_id_,
+            order->side_,
+            order->price_,
+            Qty_INVALID,
+            totalQty(order),
+        };
+        market_update_ = {
+            MarketUpdateType::CANCEL,
+            order->market_order_id_,
+            order->ticker_id_,
+            order->side_,
+            order->price_,
+            0,
+            order->priority_
+        };
+        removeOrder(order);
+        matching_engine_->sendMarketUpdate(&market_update_);
+        matching_engine_->sendClientResponse(&client_response_);
+    }
+
+    auto MEOrderBook::massCancel(ClientId client_id, Side side) noexcept -> void {
+        if(UNLIKELY(client_id >= ME_MAX_NUM_CLIENTS)) {
+            return;
+        }
+        // only walks the client's own orders, not the whole book
+        for(auto order = client_orders_[client_id]; order;) {
+            const auto next_order = order->next_client_order_;
+            if(side == Side::INVALID || order->side_ == side) {
+                cancelOrder(order);
+            }
+            order = next_order;
+        }
+    }
+
+    auto MEOrderBook::modify(ClientId client_id, OrderId order_id, TickerId ticker_id, Price price, Qty qty) noexcept -> void {
+        MEOrder *order = nullptr;
+        if(LIKELY(client_id < ME_MAX_NUM_CLIENTS)) {
+            order = cid_oid_to_order_.find(client_id, order_id);
+        }
+        if(UNLIKELY(!order || !qty || !priceInBand(price) || order->stop_price_ != Price_INVALID)) {
+            // unknown order, zero qty (has to be a cancel), a price the ladder cannot hold or a stop that has not triggered
             client_response_ = {
-                ClientResponseType::CANCELED,
+                ClientResponseType::MODIFY_REJECTED,
                 client_id,
                 ticker_id,
                 order_id,
-                exchange_order->market_order_id_,
-                exchange_order->side_,
-                exchange_order->price_,
+                OrderId_INVALID,
+                Side::INVALID,
+                price,
                 Qty_INVALID,
-                exchange_order->qty_,
+                qty
             };
+            matching_engine_->sendClientResponse(&client_response_);
+            return;
+        }
+
+        const auto side = order->side_;
+        const auto market_order_id = order->market_order_id_;
+        client_response_ = {
+            ClientResponseType::MODIFIED,
+            client_id,
+            ticker_id,
+            order_id,
+            market_order_id,
+            side,
+            price,
+            Qty_INVALID,
+            qty
+        };
+        matching_engine_->sendClientResponse(&client_response_);
+
+        // call phase -> crossing prices rest like any other, they trade at the uncross
+        const auto crosses = !in_auction_ && (side == Side::BUY ? (asks_by_price_ && price >= asks_by_price_->price_) : (bids_by_price_ && price <= bids_by_price_->price_));
+        if(UNLIKELY(crosses)) {
+            // new price is aggressive -> old order leaves the book, new qty is matched and the rest added back like a new order
             market_update_ = {
                 MarketUpdateType::CANCEL,
-                exchange_order->market_order_id_,
+                market_order_id,
                 ticker_id,
-                exchange_order->side_,
-                exchange_order->price_,
+                side,
+                order->price_,
                 0,
-                exchange_order->priority_
+                order->priority_
             };
-            removeOrder(exchange_order);
             matching_engine_->sendMarketUpdate(&market_update_);
+            const auto display_qty = order->display_qty_;
+            removeOrder(order);
+
+            const auto leaves_qty = checkForMatch(client_id, order_id, ticker_id, side, price, qty, market_order_id);
+            if(leaves_qty) {
+                const auto priority = getNextPriority(side, price);
+                auto new_order = order_pool_.allocate(ticker_id, client_id, order_id, market_order_id, side, price, leaves_qty, priority, nullptr, nullptr);
+                new_order->display_qty_ = display_qty;
+                setRestingQty(new_order, leaves_qty);
+                addOrder(new_order);
+                market_update_ = {
+                    MarketUpdateType::ADD,
+                    market_order_id,
+                    ticker_id,
+                    side,
+                    price,
+                    new_order->qty_,
+                    priority
+                };
+                matching_engine_->sendMarketUpdate(&market_update_);
+            }
+            runTriggeredStops();
+            return;
+        }
+
+        if(price == order->price_ && qty <= totalQty(order)) {
+            // only the qty goes down, order keeps its place in the queue
+            // qty is the new total, an iceberg loses its hidden reserve first
+            reduceLevelQty(order, totalQty(order) - qty);
+            order->qty_ = min(order->qty_, qty);
+            order->reserve_qty_ = qty - order->qty_;
+        } else {
+            // new price or more qty, order goes to the back of the queue at the new price
+            // same MEOrder is moved, no pool or index operations
+            unlinkOrder(order);
+            order->price_ = price;
+            setRestingQty(order, qty);
+            order->priority_ = getNextPriority(side, price);
+            linkOrder(order);
+        }
+
+        market_update_ = {
+            MarketUpdateType::MODIFY,
+            market_order_id,
+            ticker_id,
+            side,
+            price,
+            order->qty_,
+            order->priority_
+        };
+        matching_engine_->sendMarketUpdate(&market_update_);
+    }
+
+    auto MEOrderBook::auctionPrice(uint64_t *volume) noexcept -> Price {
+        *volume = 0;
+        if(!bids_by_price_ || !asks_by_price_ || bids_by_price_->price_ < asks_by_price_->price_) {
+            return Price_INVALID;
+        }
+
+        // only prices in [best ask, best bid] can trade, outside of it one of the sides has nothing
+        const auto low_index = priceToIndex(asks_by_price_->price_);
+        const auto high_index = priceToIndex(bids_by_price_->price_);
+        fill(bid_depth_.begin() + low_index, bid_depth_.begin() + high_index + 1, 0);
+        fill(ask_depth_.begin() + low_index, ask_depth_.begin() + high_index + 1, 0);
+        for(auto index = bid_levels_.findNext(low_index); index != LevelBitmap::NPOS && index <= high_index; index = bid_levels_.findNext(index + 1)) {
+            // hidden reserve trades in the uncross too, total_qty_ has it
+            bid_depth_[index] = bid_orders_at_price_[index]->total_qty_;
+        }
+        for(auto index = ask_levels_.findNext(low_index); index != LevelBitmap::NPOS && index <= high_index; index = ask_levels_.findNext(index + 1)) {
+            ask_depth_[index] = ask_orders_at_price_[index]->total_qty_;
+        }
+        // cumulative depth -> bid qty at or above, ask qty at or below each price
+        for(auto index = high_index; index > low_index; --index) {
+            bid_depth_[index - 1] += bid_depth_[index];
+        }
+        for(auto index = low_index; index < high_index; ++index) {
+            ask_depth_[index + 1] += ask_depth_[index];
+        }
+
+        const auto reference_price = (last_trade_price_ != Price_INVALID ? last_trade_price_ : reference_price_);
+        auto auction_price = Price_INVALID;
+        uint64_t best_imbalance = 0;
+        Price best_distance = 0;
+        // walked upwards, a complete tie keeps the lower price
+        for(auto index = low_index; index <= high_index; ++index) {
+            const auto index_volume = min(bid_depth_[index], ask_depth_[index]);
+            const auto imbalance = max(bid_depth_[index], ask_depth_[index]) - index_volume;
+            const auto price = min_price_ + static_cast<Price>(index);
+            const auto distance = (price > reference_price ? price - reference_price : reference_price - price);
+            if(index_volume > *volume || (index_volume == *volume && (imbalance < best_imbalance || (imbalance == best_imbalance && distance < best_distance)))) {
+                *volume = index_volume;
+                best_imbalance = imbalance;
+                best_distance = distance;
+                auction_price = price;
+            }
+        }
+        return auction_price;
+    }
+
+    auto MEOrderBook::publishIndicative() noexcept -> void {
+        uint64_t volume = 0;
+        const auto price = auctionPrice(&volume);
+        if(price == indicative_price_ && volume == indicative_qty_) {
+            return;
         }
+        indicative_price_ = price;
+        indicative_qty_ = volume;
+        market_update_ = {
+            MarketUpdateType::AUCTION_INDICATIVE,
+            OrderId_INVALID,
+            ticker_id_,
+            Side::INVALID,
+            price,
+            static_cast<Qty>(min<uint64_t>(volume, Qty_INVALID - 1)),
+            Priority_INVALID
+        };
+        matching_engine_->sendMarketUpdate(&market_update_);
+    }
+
+    auto MEOrderBook::fillAuctionOrder(MEOrder *order, Price price, Qty fill_qty) noexcept -> void {
+        const auto order_qty = order->qty_;
+        const auto shown_fill_qty = min(order->qty_, fill_qty);
+        reduceLevelQty(order, fill_qty);
+        order->qty_ -= shown_fill_qty;
+        order->reserve_qty_ -= fill_qty - shown_fill_qty;
+
+        client_response_ = {
+            ClientResponseType::FILLED,
+            order->client_id_,
+            order->ticker_id_,
+            order->client_order_id_,
+            order->market_order_id_,
+            order->side_,
+            price,
+            fill_qty,
+            totalQty(order)
+        };
         matching_engine_->sendClientResponse(&client_response_);
+
+        if(UNLIKELY(!order->qty_ && order->reserve_qty_)) {
+            refillPeak(order);
+        }
+
+        if(!order->qty_) {
+            market_update_ = {
+                MarketUpdateType::CANCEL,
+                order->market_order_id_,
+                order->ticker_id_,
+                order->side_,
+                order->price_,
+                order_qty,
+                Priority_INVALID
+            };
+            matching_engine_->sendMarketUpdate(&market_update_);
+            removeOrder(order);
+        } else {
+            market_update_ = {
+                MarketUpdateType::MODIFY,
+                order->market_order_id_,
+                order->ticker_id_,
+                order->side_,
+                order->price_,
+                order->qty_,
+                order->priority_
+            };
+            matching_engine_->sendMarketUpdate(&market_update_);
+        }
+    }
+
+    auto MEOrderBook::uncross() noexcept -> void {
+        in_auction_ = false;
+
+        // best bid against best ask until the auction volume is done, every fill completes atleast one of the two
+        // the volume is the most the book can trade at one price -> whatever is left does not cross anymore
+        // unless self trade prevention took orders out in between, the book can then still cross at another price -> priced again from what is left
+        uint64_t volume = 0;
+        for(auto price = auctionPrice(&volume); volume; price = auctionPrice(&volume)) {
+            const auto crosses = [this, price]() {
+                return (bids_by_price_ && asks_by_price_ && bids_by_price_->price_ >= price && asks_by_price_->price_ <= price);
+            };
+            auto traded = false;
+            for(auto leaves_qty = volume; leaves_qty && crosses();) {
+                const auto bid = bids_by_price_->first_me_order_;
+                const auto ask = asks_by_price_->first_me_order_;
+                if(UNLIKELY(self_trade_prevention_ != SelfTradePrevention::NONE && bid->client_id_ == ask->client_id_)) {
+                    // never trades, atleast one of the two leaves the book
+                    preventAuctionSelfTrade(bid, ask);
+                    continue;
+                }
+                const auto fill_qty = static_cast<Qty>(min<uint64_t>({totalQty(bid), totalQty(ask), leaves_qty}));
+                leaves_qty -= fill_qty;
+                traded = true;
+
+                // no aggressor in an auction trade
+                market_update_ = {
+                    MarketUpdateType::TRADE,
+                    OrderId_INVALID,
+                    ticker_id_,
+                    Side::INVALID,
+                    price,
+                    fill_qty,
+                    Priority_INVALID
+                };
+                matching_engine_->sendMarketUpdate(&market_update_);
+                fillAuctionOrder(bid, price, fill_qty);
+                fillAuctionOrder(ask, price, fill_qty);
+            }
+
+            if(traded) {
+                last_trade_price_ = price;
+            }
+        }
+        // stops held through the call phase trigger on the auction price, or the last trade before it
+        if(last_trade_price_ != Price_INVALID && (!buy_stop_levels_.empty() || !sell_stop_levels_.empty())) {
+            triggerStops(last_trade_price_);
+        }
+        runTriggeredStops();
     }
 
     auto MEOrderBook::toString(bool detailed, bool validity_check) const -> string {
@@ -236,8 +1015,8 @@ namespace Exchange {
         ss << buf;
         for (auto o_itr = itr->first_me_order_;; o_itr = o_itr->next_order_) {
             if (detailed) {
-            sprintf(buf, "[oid:%s q:%s p:%s n:%s] ",
-                    orderIdToString(o_itr->market_order_id_).c_str(), qtyToString(o_itr->qty_).c_str(),
+            sprintf(buf, "[oid:%s q:%s r:%s p:%s n:%s] ",
+                    orderIdToString(o_itr->market_order_id_).c_str(), qtyToString(o_itr->qty_).c_str(), qtyToString(o_itr->reserve_qty_).c_str(),
                     orderIdToString(o_itr->prev_order_ ? o_itr->prev_order_->market_order_id_ : OrderId_INVALID).c_str(),
                     orderIdToString(o_itr->next_order_ ? o_itr->next_order_->market_order_id_ : OrderId_INVALID).c_str());
             ss << buf;
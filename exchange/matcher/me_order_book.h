@@ -2,11 +2,14 @@
 
 #include "common/types.h"
 #include "common/mem_pool.h"
+#include "common/huge_page_allocator.h"
+#include "common/level_bitmap.h"
 #include "common/logging.h"
 #include "order_server/client_response.h"
 #include "market_data/market_update.h"
 
 #include "me_order.h"
+#include "me_order_index.h"
 using namespace std;
 using namespace Common;
 
@@ -15,16 +18,88 @@ using namespace Common;
 namespace Exchange {
     class MatchingEngine; 
 
+    // what happens when an incoming order would trade against a resting order of the same client
+    enum class SelfTradePrevention : uint8_t {
+        NONE = 0, // trades like with any other client
+        CANCEL_NEWEST = 1, // rest of the incoming order is canceled
+        CANCEL_OLDEST = 2, // resting order is canceled, incoming order keeps matching
+        CANCEL_BOTH = 3,
+        DECREMENT = 4 // smaller of the two is canceled and the larger one reduced by the same qty, both if equal
+    };
+
+    // how an incoming order is split over the resting orders at a price level
+    enum class MatchingAlgorithm : uint8_t {
+        FIFO = 0, // price-time
+        PRO_RATA = 1, // in proportion to the shown qty of every order at the level, the rounding rest in time priority
+        LMM = 2 // lead market maker gets lmm_allocation_percent_ of every level it is at first, then price-time
+    };
+
+    // per ticker orderbook configuration
+    struct MEOrderBookCfg {
+        // price ladder covers [reference_price_ - price_band_, reference_price_ + price_band_]
+        Price reference_price_ = ME_DEFAULT_REFERENCE_PRICE;
+        Price price_band_ = ME_DEFAULT_PRICE_BAND;
+        SelfTradePrevention self_trade_prevention_ = SelfTradePrevention::NONE;
+        MatchingAlgorithm matching_algorithm_ = MatchingAlgorithm::FIFO;
+        // MatchingAlgorithm::LMM only
+        ClientId lmm_client_id_ = ClientId_INVALID;
+        Qty lmm_allocation_percent_ = 0;
+        // book starts in the call phase (opening auction), continuous matching only after the first uncross
+        bool opening_auction_ = false;
+    };
+
+    // ticker -> orderbook configuration
+    typedef array<MEOrderBookCfg, ME_MAX_TICKERS> MEOrderBookCfgHashMap;
+
     class MEOrderBook final {
     public: 
-        explicit MEOrderBook(TickerId ticker_id, Logger *logger, MatchingEngine *matching_engine);
+        explicit MEOrderBook(TickerId ticker_id, const MEOrderBookCfg &cfg, Logger *logger, MatchingEngine *matching_engine);
 
         ~MEOrderBook();
 
-        auto add (ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Qty qty) noexcept -> void;
+        // display_qty < qty -> iceberg, only display_qty is shown in the book at a time, the rest is hidden and refilled from as the peak trades
+        auto add (ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Qty qty, Qty display_qty) noexcept -> void;
+
+        // IOC / FOK / market (price Price_INVALID) orders, never rest in the book
+        // unfilled quantity is canceled back to the client, without touching the order pool or publishing ADD / CANCEL updates
+        auto addImmediate(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Qty qty, bool fill_or_kill) noexcept -> void;
+
+        // stop / stop limit (price Price_INVALID -> stop), waits outside the price levels until a trade at or through stop_price
+        // then matched like a market / limit order, right away if the last trade already went through stop_price
+        auto addStop(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Price stop_price, Qty qty) noexcept -> void;
 
         auto cancel(ClientId client_id, OrderId order_id, TickerId ticker_id) noexcept -> void;
 
+        // changes a live order to price / qty (shown + hidden), published as a single MODIFY update, stop orders cannot be modified
+        // same price and lower qty -> updated in place and keeps its priority, otherwise moved to the back of the new price level
+        auto modify(ClientId client_id, OrderId order_id, TickerId ticker_id, Price price, Qty qty) noexcept -> void;
+
+        // cancels every live order of the client in this orderbook, only on one side unless side is INVALID
+        auto massCancel(ClientId client_id, Side side) noexcept -> void;
+
+        // call phase, add() / modify() rest orders without matching, IOC / FOK / market orders are canceled, stops do not trigger
+        auto startAuction() noexcept -> void {
+            in_auction_ = true;
+            indicative_price_ = Price_INVALID;
+            indicative_qty_ = 0;
+        }
+
+        auto inAuction() const noexcept {
+            return in_auction_;
+        }
+
+        // best resting price of a side, Price_INVALID if the side is empty
+        auto bestPrice(Side side) const noexcept -> Price {
+            const auto best_orders_by_price = (side == Side::BUY ? bids_by_price_ : asks_by_price_);
+            return (best_orders_by_price ? best_orders_by_price->price_ : Price_INVALID);
+        }
+
+        // publishes the price / volume an uncross would trade at now, nothing if it did not change since the last one
+        auto publishIndicative() noexcept -> void;
+
+        // ends the call phase, everything that crosses trades at the price with the most volume in one pass, then continuous matching
+        auto uncross() noexcept -> void;
+
         auto toString(bool detailed, bool validity_check) const -> string;
 
         MEOrderBook() = delete;
@@ -35,9 +110,17 @@ namespace Exchange {
 
     private: 
         TickerId ticker_id_ = TickerId_INVALID;
+        const SelfTradePrevention self_trade_prevention_ = SelfTradePrevention::NONE;
+        const MatchingAlgorithm matching_algorithm_ = MatchingAlgorithm::FIFO;
+        const ClientId lmm_client_id_ = ClientId_INVALID;
+        const Qty lmm_allocation_percent_ = 0;
+        // auction price tie break when there was no trade yet
+        const Price reference_price_ = Price_INVALID;
         MatchingEngine *matching_engine_ = nullptr;
-        // client -> all orders of that client hashmap
-        ClientOrderHashMap cid_oid_to_order_;
+        // (client, client order id) -> live order, sized by the max number of live orders
+        MEOrderIndex cid_oid_to_order_;
+        // client -> most recently added live order of that client, rest linked through next_client_order_
+        array<MEOrder *, ME_MAX_NUM_CLIENTS> client_orders_ = {};
 
         MemPool<MEOrdersAtPrice> orders_at_price_pool_;
         // points to highest price level for bids
@@ -45,97 +128,139 @@ namespace Exchange {
         // points to the lowest price level for asks 
         MEOrdersAtPrice *asks_by_price_ = nullptr;
 
-        // price -> orders at that price level hashmap
-        OrdersAtPriceHashMap price_orders_at_price_;
-
-        MemPool<MEOrder> order_pool_;
+        // price ladder anchored on the reference price, price -> orders at that price level
+        // one ladder per side, both sides rest at the same price during an auction call phase
+        Price min_price_ = Price_INVALID;
+        Price max_price_ = Price_INVALID;
+        vector<MEOrdersAtPrice *> bid_orders_at_price_;
+        vector<MEOrdersAtPrice *> ask_orders_at_price_;
+        // occupied price levels for each side, used to find the neighbour of a new price level
+        LevelBitmap bid_levels_;
+        LevelBitmap ask_levels_;
+
+        // stop orders waiting for a trade, stop price -> first of the orders at that stop price, same ladder as the price levels
+        vector<MEOrder *> buy_stops_;
+        vector<MEOrder *> sell_stops_;
+        LevelBitmap buy_stop_levels_;
+        LevelBitmap sell_stop_levels_;
+        // stops hit by a trade, matched in this order once the current order is done, linked through next_order_
+        MEOrder *triggered_stops_head_ = nullptr;
+        MEOrder *triggered_stops_tail_ = nullptr;
+        Price last_trade_price_ = Price_INVALID;
+
+        // largest allocation in the book, kept on prefaulted huge pages
+        MemPool<MEOrder, HugePageAllocator<MEOrder>> order_pool_;
+
+        // scratch space for the orders of one price level, pro-rata / lmm allocation works on these instead of the linked list
+        vector<MEOrder *> level_orders_;
+        vector<Qty> level_qtys_;
+
+        bool in_auction_ = false;
+        // last published indicative auction price / volume
+        Price indicative_price_ = Price_INVALID;
+        uint64_t indicative_qty_ = 0;
+        // qty resting at each slot of the price ladder, only the crossed part [best ask, best bid] is filled in by auctionPrice()
+        vector<uint64_t> bid_depth_;
+        vector<uint64_t> ask_depth_;
 
         MEClientResponse client_response_;
         MEMarketUpdate market_update_;
 
         OrderId next_market_order_id_ = 1;
-
-        string time_str_;
         Logger *logger_ = nullptr;
 
     private: 
+        // quantity the other side has at price or better that client_id can trade with, stops counting once qty is reached, does not modify the book
+        auto availableQty(ClientId client_id, Side side, Price price, Qty qty) const noexcept -> Qty;
+
+        // removes a live order from the book, publishes the cancel and tells the client
+        auto cancelOrder(MEOrder *order) noexcept -> void;
+
+        // moves the stops that a trade at trade_price goes through to the back of the triggered stops
+        auto triggerStops(Price trade_price) noexcept -> void;
+
+        // matches the triggered stops one at a time, stops they trigger in turn are queued behind them -> cascades loop, never recurse
+        auto runTriggeredStops() noexcept -> void;
+
+        // price that maximizes the volume traded by an uncross, then smallest imbalance, then closest to the last trade / reference price
+        // Price_INVALID and 0 volume if the book does not cross
+        auto auctionPrice(uint64_t *volume) noexcept -> Price;
+
+        // uncross fill of a resting order at the auction price, from the shown qty first then the hidden reserve
+        auto fillAuctionOrder(MEOrder *order, Price price, Qty fill_qty) noexcept -> void;
+
+        // tells the client the remaining qty of its order was canceled
+        auto sendCanceled(ClientId client_id, OrderId client_order_id, TickerId ticker_id, OrderId market_order_id, Side side, Price price, Qty leaves_qty) noexcept -> void;
+
+        // shown + hidden qty, the leaves qty the client sees
+        static auto totalQty(const MEOrder *order) noexcept -> Qty {
+            return order->qty_ + order->reserve_qty_;
+        }
+
+        // splits qty into a fresh peak and the hidden rest, plain orders show all of it
+        static auto setRestingQty(MEOrder *order, Qty qty) noexcept {
+            order->qty_ = min(qty, order->display_qty_);
+            order->reserve_qty_ = qty - order->qty_;
+        }
+
+        // limit price that matches anything on the other side, for market orders
+        static auto marketPrice(Side side) noexcept {
+            return (side == Side::BUY ? numeric_limits<Price>::max() : numeric_limits<Price>::min());
+        }
+
         // unique for all the orders (strict increment)
         auto generateNewMarketOrderId() noexcept -> OrderId {
             return next_market_order_id_++;
         }
 
-        // converts the price to index to be used in hashmap
+        // price ladder covers [min_price_, max_price_], one slot per tick
+        auto priceInBand(Price price) const noexcept {
+            return (price >= min_price_ && price <= max_price_);
+        }
+
+        // converts the price to its slot in the price ladder, price has to be inside the band
         auto priceToIndex(Price price) const noexcept {
-            return (price % ME_MAX_PRICE_LEVELS);
+            return static_cast<size_t>(price - min_price_);
         }
 
-        auto getOrdersAtPrice(Price price) const noexcept -> MEOrdersAtPrice * {
-            return price_orders_at_price_.at(priceToIndex(price));
+        auto getOrdersAtPrice(Side side, Price price) const noexcept -> MEOrdersAtPrice * {
+            return (side == Side::BUY ? bid_orders_at_price_ : ask_orders_at_price_)[priceToIndex(price)];
         }
 
         // add a price level (the order that we want to add is the first one at that price level)
         auto addOrdersAtPrice(MEOrdersAtPrice *new_orders_at_price) noexcept {
-            // assign new order to that price level 
-            price_orders_at_price_.at(priceToIndex(new_orders_at_price->price_)) = new_orders_at_price;
+            const auto side = new_orders_at_price->side_;
+            const auto index = priceToIndex(new_orders_at_price->price_);
+            // assign new order to that price level and mark the level as occupied
+            auto &orders_at_price = (side == Side::BUY ? bid_orders_at_price_ : ask_orders_at_price_);
+            orders_at_price[index] = new_orders_at_price;
+            auto &levels = (side == Side::BUY ? bid_levels_ : ask_levels_);
+            levels.set(index);
             // get the highest bid price or lowest ask price (entry point)
-            const auto best_orders_by_price = (new_orders_at_price->side_ == Side::BUY ? bids_by_price_ : asks_by_price_);
+            auto &best_orders_by_price = (side == Side::BUY ? bids_by_price_ : asks_by_price_);
 
             if(UNLIKELY(!best_orders_by_price)){
                 // if no best order -> new order is the first one in the orderbook
-                // assign that as entry point to bids / asks
-                (new_orders_at_price->side_ == Side::BUY ? bids_by_price_ : asks_by_price_) = new_orders_at_price;
                 // point the price level to itself (circular doubly linked list)
+                best_orders_by_price = new_orders_at_price;
                 new_orders_at_price->prev_entry_ = new_orders_at_price->next_entry_ = new_orders_at_price;
-            } else {
-                // traverse until you find the correct price level 
-                auto target = best_orders_by_price;
-                // condition: lower bid price or higher ask price 
-                bool add_after = (
-                    (new_orders_at_price->side_ == Side::SELL && new_orders_at_price->price_ > target->price_) || 
-                    (new_orders_at_price->side_ == Side::BUY && new_orders_at_price->price_ < target->price_)
-                );
-                // early check because new order prices are usually close to the best bids or asks 
-                if(add_after) {
-                    target = target->next_entry_;
-                    add_after = (
-                        (new_orders_at_price->side_ == Side::SELL && new_orders_at_price->price_ > target->price_) || 
-                        (new_orders_at_price->side_ == Side::BUY && new_orders_at_price->price_ < target->price_)
-                    );
-                }
-                while(add_after && target != best_orders_by_price) {
-                    add_after = (
-                        (new_orders_at_price->side_ == Side::SELL && new_orders_at_price->price_ > target->price_) || 
-                        (new_orders_at_price->side_ == Side::BUY && new_orders_at_price->price_ < target->price_)
-                    );
-                    if(add_after) {
-                        target = target->next_entry_;
-                    }
-                }
-                // actually add the order at the right place
-                if(add_after){
-                    // we have reached the end of all orders at that price level
-                    if(target == best_orders_by_price){
-                        target = best_orders_by_price->prev_entry_;
-                    }
-                    new_orders_at_price->prev_entry_ = target;
-                    target->next_entry_->prev_entry_ = new_orders_at_price;
-                    new_orders_at_price->next_entry_ = target->next_entry_;
-                    target->next_entry_ = new_orders_at_price;
-                } else {
-                    new_orders_at_price->prev_entry_ = target->prev_entry_;
-                    new_orders_at_price->next_entry_ = target;
-                    target->prev_entry_->next_entry_ = new_orders_at_price;
-                    target->prev_entry_= new_orders_at_price;
-
-                    if (
-                        (new_orders_at_price->side_ == Side::BUY && new_orders_at_price->price_ > target->price_) || 
-                        (new_orders_at_price->side_ == Side::SELL && new_orders_at_price->price_ < target->price_)
-                    ){
-                        // new order is the best bid or ask
-                        target->next_entry_ = (target->next_entry_ == best_orders_by_price ? new_orders_at_price : target->next_entry_);
-                        (new_orders_at_price->side_ == Side::BUY ? bids_by_price_ : bids_by_price_) = new_orders_at_price;
-                    }
-                }
+                return;
+            }
+
+            // closest occupied level which is worse than the new one -> lower bid or higher ask
+            // new level goes right in front of it, no walk over the price levels needed
+            const auto worse_index = (side == Side::BUY ? (index ? levels.findPrev(index - 1) : LevelBitmap::NPOS) : levels.findNext(index + 1));
+            // no worse level -> new level is the worst one, add it at the end (just before the best one)
+            auto target = (worse_index != LevelBitmap::NPOS ? orders_at_price[worse_index] : best_orders_by_price);
+
+            new_orders_at_price->prev_entry_ = target->prev_entry_;
+            new_orders_at_price->next_entry_ = target;
+            target->prev_entry_->next_entry_ = new_orders_at_price;
+            target->prev_entry_ = new_orders_at_price;
+
+            if(worse_index != LevelBitmap::NPOS && target == best_orders_by_price) {
+                // new order is the best bid or ask
+                best_orders_by_price = new_orders_at_price;
             }
         }
 
@@ -144,7 +269,7 @@ namespace Exchange {
             // get entry point
             const auto best_orders_by_price = (side == Side::BUY ? bids_by_price_ : asks_by_price_);
             // get all orders at given price 
-            auto orders_at_price = getOrdersAtPrice(price);
+            auto orders_at_price = getOrdersAtPrice(side, price);
 
             if(UNLIKELY(orders_at_price->next_entry_ == orders_at_price)) {
                 // if it is the only price level in the order book 
@@ -161,13 +286,14 @@ namespace Exchange {
                 // remove next and prev pointers for price level to remove 
                 orders_at_price->prev_entry_ = orders_at_price->next_entry_ = nullptr;
             }
-            // deallocate space for that price level 
-            price_orders_at_price_ .at(priceToIndex(price)) = nullptr;
+            // deallocate space for that price level and mark it as empty
+            (side == Side::BUY ? bid_orders_at_price_ : ask_orders_at_price_)[priceToIndex(price)] = nullptr;
+            (side == Side::BUY ? bid_levels_ : ask_levels_).clear(priceToIndex(price));
             orders_at_price_pool_.deallocate(orders_at_price);
         }
 
-        auto getNextPriority(Price price) noexcept {
-            const auto orders_at_price = getOrdersAtPrice(price);
+        auto getNextPriority(Side side, Price price) noexcept {
+            const auto orders_at_price = getOrdersAtPrice(side, price);
             if(!orders_at_price){
                 return 1lu;
             }
@@ -175,13 +301,31 @@ namespace Exchange {
             return orders_at_price->first_me_order_->prev_order_->priority_ + 1;
         }
 
-        auto match(TickerId ticker_id, ClientId client_id, Side side, OrderId client_order_id, OrderId new_market_order_id, MEOrder *bid_itr, Qty *leaves_qty) noexcept;
+        // fills the incoming order against itr, atmost max_fill_qty
+        auto match(TickerId ticker_id, ClientId client_id, Side side, OrderId client_order_id, OrderId new_market_order_id, MEOrder *itr, Qty *leaves_qty, Qty max_fill_qty = Qty_INVALID) noexcept;
 
+        // incoming order is about to trade with order of the same client, applies self_trade_prevention_ instead, never trades
+        auto preventSelfTrade(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, OrderId new_market_order_id, MEOrder *order, Qty *leaves_qty) noexcept -> void;
+
+        // uncross is about to trade two resting orders of the same client, same modes with the later order as the newest one
+        auto preventAuctionSelfTrade(MEOrder *bid, MEOrder *ask) noexcept -> void;
+
+        // splits leaves_qty over the whole level in proportion to the shown qty, false if leaves_qty takes the whole level anyway
+        auto matchProRata(MEOrdersAtPrice *orders_at_price, ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, OrderId new_market_order_id, Qty *leaves_qty) noexcept -> bool;
+
+        // fills the lead market maker's orders at the level upto its share of leaves_qty, false if it has none there
+        auto matchLMM(MEOrdersAtPrice *orders_at_price, ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, OrderId new_market_order_id, Qty *leaves_qty) noexcept -> bool;
+
+        // matching loop with the algorithm compiled in, FIFO is the plain walk from first_me_order_
+        template<MatchingAlgorithm algorithm>
+        auto matchOrder(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Qty qty, OrderId new_market_order_id) noexcept -> Qty;
+
+        // picks the matchOrder<>() of this book's algorithm
         auto checkForMatch(ClientId client_id, OrderId client_order_id, TickerId ticker_id, Side side, Price price, Qty qty, Qty new_market_order_id) noexcept;
 
-        // remove a single order
-        auto removeOrder(MEOrder *order) noexcept {
-            auto orders_at_price = getOrdersAtPrice(order->price_);
+        // takes a single order out of its price level, order stays allocated and indexed
+        auto unlinkOrder(MEOrder *order) noexcept {
+            auto orders_at_price = getOrdersAtPrice(order->side_, order->price_);
 
             if(order->prev_order_ == order){
                 // if it is the only order at that price level, remove the whole price level 
@@ -200,22 +344,79 @@ namespace Exchange {
                 }
                 // clean up previous and next order pointers
                 order->prev_order_ = order->next_order_ = nullptr;
+                orders_at_price->total_qty_ -= totalQty(order);
             }
+        }
+
+        // resting order is filled or reduced in place by qty, called before its own qty goes down
+        auto reduceLevelQty(const MEOrder *order, Qty qty) noexcept {
+            getOrdersAtPrice(order->side_, order->price_)->total_qty_ -= qty;
+        }
 
-            // remove from client -> orders hashmap AND deallocate memory from order pool
-            cid_oid_to_order_.at(order->client_id_).at(order->client_order_id_) = nullptr;
+        // remove from client -> orders hashmap and the client's list of orders
+        auto unindexOrder(MEOrder *order) noexcept {
+            cid_oid_to_order_.erase(order->client_id_, order->client_order_id_);
+            if(LIKELY(order->client_id_ < ME_MAX_NUM_CLIENTS)) {
+                (order->prev_client_order_ ? order->prev_client_order_->next_client_order_ : client_orders_[order->client_id_]) = order->next_client_order_;
+                if(order->next_client_order_) {
+                    order->next_client_order_->prev_client_order_ = order->prev_client_order_;
+                }
+                order->prev_client_order_ = order->next_client_order_ = nullptr;
+            }
+        }
+
+        // remove a single order
+        auto removeOrder(MEOrder *order) noexcept {
+            unlinkOrder(order);
+            // remove from the client lookups AND deallocate memory from order pool
+            unindexOrder(order);
             order_pool_.deallocate(order);
         }
-        
-        // add a single order
-        auto addOrder(MEOrder *order) noexcept {
-            const auto orders_at_price = getOrdersAtPrice(order->price_);
+
+        // puts a stop order at the back of the orders waiting at its stop price
+        auto linkStopOrder(MEOrder *order) noexcept {
+            const auto index = priceToIndex(order->stop_price_);
+            auto &first_order = (order->side_ == Side::BUY ? buy_stops_ : sell_stops_)[index];
+            if(!first_order) {
+                order->next_order_ = order->prev_order_ = order;
+                first_order = order;
+                (order->side_ == Side::BUY ? buy_stop_levels_ : sell_stop_levels_).set(index);
+            } else {
+                first_order->prev_order_->next_order_ = order;
+                order->prev_order_ = first_order->prev_order_;
+                order->next_order_ = first_order;
+                first_order->prev_order_ = order;
+            }
+        }
+
+        // takes a stop order out of the orders waiting at its stop price
+        auto unlinkStopOrder(MEOrder *order) noexcept {
+            const auto index = priceToIndex(order->stop_price_);
+            auto &first_order = (order->side_ == Side::BUY ? buy_stops_ : sell_stops_)[index];
+            if(order->prev_order_ == order) {
+                first_order = nullptr;
+                (order->side_ == Side::BUY ? buy_stop_levels_ : sell_stop_levels_).clear(index);
+            } else {
+                order->prev_order_->next_order_ = order->next_order_;
+                order->next_order_->prev_order_ = order->prev_order_;
+                if(first_order == order) {
+                    first_order = order->next_order_;
+                }
+            }
+            order->prev_order_ = order->next_order_ = nullptr;
+        }
+
+        // puts a single order at the back of its price level
+        auto linkOrder(MEOrder *order) noexcept {
+            const auto orders_at_price = getOrdersAtPrice(order->side_, order->price_);
 
             if(!orders_at_price){
                 // point the next and prev pointers to itself (it is the only order at that price level)
                 order->next_order_ = order->prev_order_ = order;
                 // alocate space in memory pool
                 auto new_orders_at_price = orders_at_price_pool_.allocate(order->side_, order->price_, order, nullptr, nullptr);
+                new_orders_at_price->client_mask_ = clientMaskBit(order->client_id_);
+                new_orders_at_price->total_qty_ = totalQty(order);
                 // create a new price level 
                 addOrdersAtPrice(new_orders_at_price);
             } else {
@@ -226,9 +427,45 @@ namespace Exchange {
                 order->prev_order_ = first_order->prev_order_;
                 order->next_order_ = first_order;
                 first_order->prev_order_ = order;
+                orders_at_price->client_mask_ |= clientMaskBit(order->client_id_);
+                orders_at_price->total_qty_ += totalQty(order);
+            }
+        }
+
+        // create entry in client to orders hashmap and put it at the front of the client's list of orders
+        auto indexOrder(MEOrder *order) noexcept {
+            cid_oid_to_order_.insert(order);
+            if(LIKELY(order->client_id_ < ME_MAX_NUM_CLIENTS)) {
+                auto &client_orders = client_orders_[order->client_id_];
+                order->prev_client_order_ = nullptr;
+                order->next_client_order_ = client_orders;
+                if(client_orders) {
+                    client_orders->prev_client_order_ = order;
+                }
+                client_orders = order;
+            }
+        }
+
+        // add a single order
+        auto addOrder(MEOrder *order) noexcept {
+            linkOrder(order);
+            indexOrder(order);
+        }
+
+        // iceberg peak traded away -> next peak from the hidden reserve, at the back of the price level with a new priority
+        auto refillPeak(MEOrder *order) noexcept {
+            order->qty_ = min(order->display_qty_, order->reserve_qty_);
+            order->reserve_qty_ -= order->qty_;
+            order->priority_ = getNextPriority(order->side_, order->price_);
+            auto orders_at_price = getOrdersAtPrice(order->side_, order->price_);
+            if(LIKELY(orders_at_price->first_me_order_ == order)) {
+                // price-time always fills the first order, moving the level head past it makes it the last one
+                orders_at_price->first_me_order_ = order->next_order_;
+            } else {
+                // lmm allocation can fill any order of the level, level has other orders -> survives the unlink
+                unlinkOrder(order);
+                linkOrder(order);
             }
-            // create entry in client to orders hashmap 
-            cid_oid_to_order_.at(order->client_id_).at(order->client_order_id_) = order;
         }
     };
 
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vector>
+
+#include "common/types.h"
+#include "common/macros.h"
+
+#include "me_order.h"
+using namespace std;
+using namespace Common;
+
+// (client id, client order id) -> live order lookup for one orderbook
+// open addressed hashtable with linear probing, all slots preallocated upfront
+// memory depends on max number of live orders, not on the size of the order id space
+
+namespace Exchange {
+    class MEOrderIndex final {
+    public:
+        // table is kept at most half full, so probe sequences stay short
+        explicit MEOrderIndex(size_t max_orders) {
+            size_t num_slots = 1;
+            while(num_slots < 2 * max_orders) {
+                num_slots <<= 1;
+            }
+            slots_.resize(num_slots);
+            mask_ = num_slots - 1;
+        }
+
+        // returns nullptr if there is no live order for that client with that order id
+        auto find(ClientId client_id, OrderId client_order_id) const noexcept -> MEOrder * {
+            for(auto i = slotIndex(client_id, client_order_id);; i = (i + 1) & mask_) {
+                const auto &slot = slots_[i];
+                if(!slot.order_) {
+                    return nullptr;
+                }
+                if(slot.client_order_id_ == client_order_id && slot.client_id_ == client_id) {
+                    return slot.order_;
+                }
+            }
+        }
+
+        auto insert(MEOrder *order) noexcept {
+            ASSERT(size_ < slots_.size() / 2, "MEOrderIndex out of space, size:" + to_string(size_));
+            auto i = slotIndex(order->client_id_, order->client_order_id_);
+            // occupied slot with the same key gets overwritten, same as the old array based hashmap
+            while(slots_[i].order_ && !(slots_[i].client_order_id_ == order->client_order_id_ && slots_[i].client_id_ == order->client_id_)) {
+                i = (i + 1) & mask_;
+            }
+            size_ += (slots_[i].order_ == nullptr);
+            slots_[i] = {order->client_order_id_, order, order->client_id_};
+        }
+
+        auto erase(ClientId client_id, OrderId client_order_id) noexcept {
+            auto i = slotIndex(client_id, client_order_id);
+            while(slots_[i].order_ && !(slots_[i].client_order_id_ == client_order_id && slots_[i].client_id_ == client_id)) {
+                i = (i + 1) & mask_;
+            }
+            if(UNLIKELY(!slots_[i].order_)) {
+                return;
+            }
+            --size_;
+
+            // backward shift deletion -> no tombstones, so lookups never slow down over time
+            // move later entries of the same probe chain into the hole left behind
+            auto hole = i;
+            for(auto j = (i + 1) & mask_; slots_[j].order_; j = (j + 1) & mask_) {
+                const auto home = slotIndex(slots_[j].client_id_, slots_[j].client_order_id_);
+                // entry can only move back if its home slot is not between the hole and itself
+                if(((j - home) & mask_) >= ((j - hole) & mask_)) {
+                    slots_[hole] = slots_[j];
+                    hole = j;
+                }
+            }
+            slots_[hole] = {};
+        }
+
+        auto clear() noexcept {
+            fill(slots_.begin(), slots_.end(), Slot{});
+            size_ = 0;
+        }
+
+        auto size() const noexcept {
+            return size_;
+        }
+
+        MEOrderIndex() = delete;
+        MEOrderIndex(const MEOrderIndex &) = delete;
+        MEOrderIndex(const MEOrderIndex &&) = delete;
+        MEOrderIndex &operator=(const MEOrderIndex &) = delete;
+        MEOrderIndex &operator=(const MEOrderIndex &&) = delete;
+
+    private:
+        // key stored next to the pointer, so probing does not touch the order itself
+        struct Slot {
+            OrderId client_order_id_ = OrderId_INVALID;
+            MEOrder *order_ = nullptr;
+            ClientId client_id_ = ClientId_INVALID;
+        };
+
+        auto slotIndex(ClientId client_id, OrderId client_order_id) const noexcept -> size_t {
+            // client order ids are usually sequential per client, mix them so they spread over the table
+            auto h = client_order_id * 0x9E3779B97F4A7C15ull ^ (static_cast<uint64_t>(client_id) * 0xC2B2AE3D27D4EB4Full);
+            h ^= (h >> 29);
+            return h & mask_;
+        }
+
+        vector<Slot> slots_;
+        size_t mask_ = 0;
+        size_t size_ = 0;
+    };
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <array>
+#include <limits>
+
+#include "common/types.h"
+#include "common/macros.h"
+#include "common/time_utils.h"
+
+#include "order_server/client_request.h"
+#include "order_server/client_response.h"
+#include "market_data/market_update.h"
+
+#include "me_order_book.h"
+using namespace std;
+using namespace Common;
+
+// pre-trade risk checks, run on the matching engine thread right before a request reaches the orderbook
+// everything is a flat array indexed by client / ticker id, no lookups, no allocations
+
+namespace Exchange {
+    // message rate limit counts requests in fixed windows of this length
+    constexpr Nanos ME_RISK_RATE_WINDOW_NANOS = NANOS_TO_SECS;
+
+    // per client limits, defaults -> no limit
+    struct MERiskCfg {
+        // qty of a single order / modify
+        Qty max_order_qty_ = Qty_INVALID;
+        // price * qty of a single order / modify, market orders are valued at the last trade price, before the first trade at the best opposite price
+        uint64_t max_notional_ = numeric_limits<uint64_t>::max();
+        // live orders (resting, stops and the ones being matched) of the client, over all of its tickers
+        uint32_t max_open_orders_ = numeric_limits<uint32_t>::max();
+        // max distance in ticks of a limit price from the last trade price of the ticker, no check before the first trade
+        Price price_collar_ = numeric_limits<Price>::max();
+        // requests per ME_RISK_RATE_WINDOW_NANOS over all of its tickers, cancels are never counted or throttled
+        uint32_t max_msgs_per_window_ = numeric_limits<uint32_t>::max();
+    };
+
+    // client -> risk limits
+    typedef array<MERiskCfg, ME_MAX_NUM_CLIENTS> MERiskCfgHashMap;
+
+    class MERiskGateway final {
+    public:
+        // one gateway per matching engine shard, each one only sees the requests for the tickers of its shard
+        // -> the limits over all of a client's tickers are split evenly over the shards, per order limits stay as they are
+        explicit MERiskGateway(const MERiskCfgHashMap &risk_cfg, size_t num_shards) {
+            ASSERT(num_shards >= 1, "Invalid number of shards:" + to_string(num_shards));
+            for(size_t client_id = 0; client_id < ME_MAX_NUM_CLIENTS; ++client_id) {
+                auto &cfg = clients_[client_id].cfg_;
+                cfg = risk_cfg[client_id];
+                cfg.max_open_orders_ = shardLimit(cfg.max_open_orders_, num_shards);
+                cfg.max_msgs_per_window_ = shardLimit(cfg.max_msgs_per_window_, num_shards);
+            }
+            last_trade_price_.fill(Price_INVALID);
+        }
+
+        // RejectReason::INVALID -> request can go on to the orderbook
+        // order_book is the book of the request's ticker, nullptr if this shard has none
+        auto check(const MEClientRequest *request, Nanos now, const MEOrderBook *order_book) noexcept -> RejectReason {
+            switch(request->type_) {
+                case ClientRequestType::NEW:
+                case ClientRequestType::NEW_IOC:
+                case ClientRequestType::NEW_FOK:
+                    return checkOrder(request, now, request->price_, true, true);
+                case ClientRequestType::NEW_MARKET:
+                    return checkOrder(request, now, marketOrderPrice(request, order_book), true, false);
+                case ClientRequestType::NEW_STOP:
+                    return checkOrder(request, now, request->stop_price_, true, false);
+                case ClientRequestType::NEW_STOP_LIMIT:
+                    // limit price is meant for after the trigger, not collared against the trade price now
+                    return checkOrder(request, now, request->price_, true, false);
+                case ClientRequestType::MODIFY:
+                    return checkOrder(request, now, request->price_, false, true);
+                default:
+                    // cancels only take risk off, auction requests are not orders and only come from the order server's auction control client
+                    return RejectReason::INVALID;
+            }
+        }
+
+        // keeps the open order count of each client from what the orderbook tells the client
+        auto onClientResponse(const MEClientResponse *response) noexcept {
+            if(UNLIKELY(response->client_id_ >= ME_MAX_NUM_CLIENTS)) {
+                return;
+            }
+            auto &client = clients_[response->client_id_];
+            switch(response->type_) {
+                case ClientResponseType::ACCEPTED:
+                    ++client.open_orders_;
+                    break;
+                case ClientResponseType::CANCELED:
+                    --client.open_orders_;
+                    break;
+                case ClientResponseType::FILLED:
+                    client.open_orders_ -= !response->leaves_qty_;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // collars are relative to the last trade of each ticker
+        auto onMarketUpdate(const MEMarketUpdate *market_update) noexcept {
+            if(market_update->type_ == MarketUpdateType::TRADE) {
+                last_trade_price_[market_update->ticker_id_] = market_update->price_;
+            }
+        }
+
+        MERiskGateway() = delete;
+        MERiskGateway(const MERiskGateway &) = delete;
+        MERiskGateway(const MERiskGateway &&) = delete;
+        MERiskGateway &operator=(const MERiskGateway &) = delete;
+        MERiskGateway &operator=(const MERiskGateway &&) = delete;
+
+    private:
+        // limits and running state of one client next to each other -> one cache line per check
+        struct alignas(64) ClientRisk {
+            MERiskCfg cfg_;
+            uint32_t open_orders_ = 0;
+            uint32_t window_msgs_ = 0;
+            Nanos window_start_ = 0;
+        };
+
+        array<ClientRisk, ME_MAX_NUM_CLIENTS> clients_;
+        array<Price, ME_MAX_TICKERS> last_trade_price_;
+
+        auto lastTradePrice(TickerId ticker_id) const noexcept -> Price {
+            return (LIKELY(ticker_id < ME_MAX_TICKERS) ? last_trade_price_[ticker_id] : Price_INVALID);
+        }
+
+        // no trade yet -> the price the order would trade at first, Price_INVALID only if there is nothing to trade with (order is canceled unfilled)
+        auto marketOrderPrice(const MEClientRequest *request, const MEOrderBook *order_book) const noexcept -> Price {
+            const auto last_trade_price = lastTradePrice(request->ticker_id_);
+            if(LIKELY(last_trade_price != Price_INVALID) || !order_book) {
+                return last_trade_price;
+            }
+            return order_book->bestPrice(request->side_ == Side::BUY ? Side::SELL : Side::BUY);
+        }
+
+        // a client-wide limit split over num_shards, no limit stays no limit, a non zero limit below num_shards still leaves one per shard
+        static auto shardLimit(uint32_t limit, size_t num_shards) noexcept -> uint32_t {
+            if(limit == numeric_limits<uint32_t>::max()) {
+                return limit;
+            }
+            return max(static_cast<uint32_t>(limit / num_shards), min<uint32_t>(limit, 1));
+        }
+
+        // price Price_INVALID -> no notional check, new_order -> counts towards the open orders
+        auto checkOrder(const MEClientRequest *request, Nanos now, Price price, bool new_order, bool collared) noexcept -> RejectReason {
+            if(UNLIKELY(request->client_id_ >= ME_MAX_NUM_CLIENTS)) {
+                // unknown client, the orderbook rejects / ignores it
+                return RejectReason::INVALID;
+            }
+            auto &client = clients_[request->client_id_];
+            const auto &cfg = client.cfg_;
+
+            // every order / modify counts towards the rate, rejected ones too
+            if(now - client.window_start_ >= ME_RISK_RATE_WINDOW_NANOS) {
+                client.window_start_ = now;
+                client.window_msgs_ = 0;
+            }
+            if(UNLIKELY(++client.window_msgs_ > cfg.max_msgs_per_window_)) {
+                return RejectReason::MESSAGE_RATE;
+            }
+
+            if(UNLIKELY(request->qty_ > cfg.max_order_qty_)) {
+                return RejectReason::ORDER_QTY;
+            }
+            if(UNLIKELY(new_order && client.open_orders_ >= cfg.max_open_orders_)) {
+                return RejectReason::OPEN_ORDERS;
+            }
+            if(price != Price_INVALID) {
+                // price * qty > max_notional_ without the multiplication overflowing
+                const auto abs_price = static_cast<uint64_t>(price < 0 ? -price : price);
+                if(UNLIKELY(request->qty_ && abs_price > cfg.max_notional_ / request->qty_)) {
+                    return RejectReason::NOTIONAL;
+                }
+            }
+            const auto last_trade_price = lastTradePrice(request->ticker_id_);
+            if(collared && price != Price_INVALID && last_trade_price != Price_INVALID) {
+                // distance computed unsigned, cannot overflow for far away prices
+                const auto distance = (price > last_trade_price ? static_cast<uint64_t>(price) - static_cast<uint64_t>(last_trade_price)
+                                                                : static_cast<uint64_t>(last_trade_price) - static_cast<uint64_t>(price));
+                if(UNLIKELY(distance > static_cast<uint64_t>(cfg.price_collar_))) {
+                    return RejectReason::PRICE_COLLAR;
+                }
+            }
+            return RejectReason::INVALID;
+        }
+    };
+}
@@ -1,8 +1,10 @@
 #pragma once 
 
 #include "common/types.h"
-#include "common/lf_queue.h"
+#include "common/spsc_lf_queue.h"
+#include "common/huge_page_allocator.h"
 #include <sstream>
+#include <array>
 
 using namespace Common;
 using namespace std;
@@ -12,7 +14,26 @@ namespace Exchange {
     enum class ClientRequestType: uint8_t {
         INVALID = 0,
         NEW = 1,
-        CANCEL = 2
+        CANCEL = 2,
+        // matched right away, whatever cannot be filled is canceled instead of resting in the book
+        NEW_IOC = 3,
+        // filled completely right away or not at all
+        NEW_FOK = 4,
+        // IOC without a price limit, price_ is ignored
+        NEW_MARKET = 5,
+        // cancel-replace of a live order to price_ / qty_ in one step, keeps queue priority if only the qty goes down
+        MODIFY = 6,
+        // cancels every live order of client_id_, ticker_id_ / side_ INVALID -> all tickers / both sides
+        MASS_CANCEL = 7,
+        // held back until a trade at or through stop_price_ (>= for buys, <= for sells), then a market order, price_ is ignored
+        NEW_STOP = 8,
+        // same trigger as NEW_STOP, then a limit order at price_
+        NEW_STOP_LIMIT = 9,
+        // ticker_id_ goes into the call phase, new orders rest without matching until AUCTION_UNCROSS
+        // exchange control, the order server only takes the two auction requests from its auction control client
+        AUCTION_START = 10,
+        // ends the call phase of ticker_id_, crossed orders trade at the single auction price, then continuous matching
+        AUCTION_UNCROSS = 11
     };
 
     inline string clientRequestTypeToString(ClientRequestType type) {
@@ -23,6 +44,24 @@ namespace Exchange {
                 return "NEW";
             case ClientRequestType::CANCEL:
                 return "CANCEL";
+            case ClientRequestType::NEW_IOC:
+                return "NEW_IOC";
+            case ClientRequestType::NEW_FOK:
+                return "NEW_FOK";
+            case ClientRequestType::NEW_MARKET:
+                return "NEW_MARKET";
+            case ClientRequestType::MODIFY:
+                return "MODIFY";
+            case ClientRequestType::MASS_CANCEL:
+                return "MASS_CANCEL";
+            case ClientRequestType::NEW_STOP:
+                return "NEW_STOP";
+            case ClientRequestType::NEW_STOP_LIMIT:
+                return "NEW_STOP_LIMIT";
+            case ClientRequestType::AUCTION_START:
+                return "AUCTION_START";
+            case ClientRequestType::AUCTION_UNCROSS:
+                return "AUCTION_UNCROSS";
         }
         return "UNKOWN";
     }
@@ -36,6 +75,11 @@ namespace Exchange {
         Side side_ = Side::INVALID;
         Price price_ = Price_INVALID;
         Qty qty_ = Qty_INVALID;
+        // NEW only, iceberg peak -> qty shown in the book, rest of qty_ is a hidden reserve
+        // Qty_INVALID (or >= qty_) -> whole qty is shown
+        Qty display_qty_ = Qty_INVALID;
+        // NEW_STOP / NEW_STOP_LIMIT only, trade price that triggers the order
+        Price stop_price_ = Price_INVALID;
 
         auto toString() const {
             stringstream ss;
@@ -48,6 +92,8 @@ namespace Exchange {
                << " side:" << sideToString(side_)
                << " price:" << priceToString(price_)
                << " qty:" << qtyToString(qty_)
+               << " display_qty:" << qtyToString(display_qty_)
+               << " stop_price:" << priceToString(stop_price_)
                << "]";
             return ss.str();
         }
@@ -70,5 +116,8 @@ namespace Exchange {
 
 #pragma pack(pop)
     
-    typedef LFQueue<MEClientRequest> ClientRequestLFQueue;
+    // sequencer -> matching engine, one producer and one consumer
+    typedef SPSCLFQueue<MEClientRequest, HugePageAllocator<MEClientRequest>> ClientRequestLFQueue;
+    // one queue per matching engine shard
+    typedef array<ClientRequestLFQueue *, ME_MAX_SHARDS> ClientRequestLFQueues;
 }
\ No newline at end of file
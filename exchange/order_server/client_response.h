@@ -1,8 +1,10 @@
 #pragma once 
 
 #include <sstream>
+#include <array>
 #include "common/types.h"
-#include "common/lf_queue.h"
+#include "common/spsc_lf_queue.h"
+#include "common/huge_page_allocator.h"
 
 using namespace std;
 using namespace Common; 
@@ -15,6 +17,12 @@ namespace Exchange {
         CANCELED = 2,
         FILLED = 3,
         CANCEL_REJECTED = 4,    
+        MODIFIED = 5,
+        MODIFY_REJECTED = 6,
+        // stop order hit its stop price and is now matched as a market / limit order
+        TRIGGERED = 7,
+        // stopped by the pre-trade risk checks / order server before reaching the orderbook, reject_reason_ says which one
+        REJECTED = 8,
     };
 
     inline string clientResponseTypeToString(ClientResponseType type) {
@@ -29,9 +37,61 @@ namespace Exchange {
                 return "FILLED";
             case ClientResponseType::CANCEL_REJECTED:
                 return "CANCEL_REJECTED";
+            case ClientResponseType::MODIFIED:
+                return "MODIFIED";
+            case ClientResponseType::MODIFY_REJECTED:
+                return "MODIFY_REJECTED";
+            case ClientResponseType::TRIGGERED:
+                return "TRIGGERED";
+            case ClientResponseType::REJECTED:
+                return "REJECTED";
         } 
         return "UNKNOWN";
     }
+
+    // pre-trade risk limit that a REJECTED request broke
+    enum class RejectReason: uint8_t {
+        INVALID = 0,
+        ORDER_QTY = 1,
+        NOTIONAL = 2,
+        OPEN_ORDERS = 3,
+        PRICE_COLLAR = 4,
+        MESSAGE_RATE = 5,
+        // order server only, client is over its token bucket rate
+        THROTTLED = 6,
+        // order server only, no room left for the request towards the matching engine
+        OVERLOADED = 7,
+        // order server only, request type the client is not allowed to send, eg. auction control
+        NOT_PERMITTED = 8,
+        // order server only, ticker id out of range, INVALID is only taken by a MASS_CANCEL of every ticker
+        INVALID_TICKER = 9
+    };
+
+    inline string rejectReasonToString(RejectReason reason) {
+        switch (reason) {
+            case RejectReason::INVALID:
+                return "INVALID";
+            case RejectReason::ORDER_QTY:
+                return "ORDER_QTY";
+            case RejectReason::NOTIONAL:
+                return "NOTIONAL";
+            case RejectReason::OPEN_ORDERS:
+                return "OPEN_ORDERS";
+            case RejectReason::PRICE_COLLAR:
+                return "PRICE_COLLAR";
+            case RejectReason::MESSAGE_RATE:
+                return "MESSAGE_RATE";
+            case RejectReason::THROTTLED:
+                return "THROTTLED";
+            case RejectReason::OVERLOADED:
+                return "OVERLOADED";
+            case RejectReason::NOT_PERMITTED:
+                return "NOT_PERMITTED";
+            case RejectReason::INVALID_TICKER:
+                return "INVALID_TICKER";
+        }
+        return "UNKNOWN";
+    }
 #pragma pack(push, 1)
 
     struct MEClientResponse {
@@ -44,6 +104,8 @@ namespace Exchange {
         Price price_ = Price_INVALID;
         Qty exec_qty_ = Qty_INVALID;
         Qty leaves_qty_ = Qty_INVALID;
+        // REJECTED only
+        RejectReason reject_reason_ = RejectReason::INVALID;
 
         auto toString() const {
             stringstream ss;
@@ -58,6 +120,7 @@ namespace Exchange {
                << " price:" << priceToString(price_)
                << " exec_qty:" << qtyToString(exec_qty_)
                << " leaves_qty:" << qtyToString(leaves_qty_)
+               << " reject_reason:" << rejectReasonToString(reject_reason_)
                << "]";
             return ss.str();
         }
@@ -80,5 +143,8 @@ namespace Exchange {
 
 #pragma pack(pop)
 
-    typedef LFQueue<MEClientResponse> ClientResponseLFQueue;
+    // matching engine -> order server, one producer and one consumer
+    typedef SPSCLFQueue<MEClientResponse, HugePageAllocator<MEClientResponse>> ClientResponseLFQueue;
+    // one queue per matching engine shard
+    typedef array<ClientResponseLFQueue *, ME_MAX_SHARDS> ClientResponseLFQueues;
 }
\ No newline at end of file
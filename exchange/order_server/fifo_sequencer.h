@@ -1,4 +1,4 @@
-#pragma once 
+#pragma once
 
 #include "common/thread_utils.h"
 #include "common/macros.h"
@@ -6,45 +6,68 @@
 
 #include "order_server/client_request.h"
 #include <array>
+#include <vector>
 #include <algorithm>
 using namespace std;
 
+// requests are kept per shard, in the order they were added
+// requests added back to back with non decreasing receive times form a sorted run -> every read from a socket is one run,
+// since all its requests share the read's timestamp, and so is a stretch of a gateway queue
+// publishing k-way merges the runs of a shard by receive time with a heap of k entries, straight into the shard's queue
+// -> O(n log k) and the requests themselves are copied once, no sort moving them around
+
 namespace Exchange {
-    constexpr size_t ME_MAX_PENDING_REQUESTS = 1024;
+    // default number of requests each shard can have pending, all preallocated
+    constexpr size_t ME_MAX_PENDING_REQUESTS = 16 * 1024;
 
     class FIFOSequencer{
     public:
-        FIFOSequencer(ClientRequestLFQueue *client_requests, Logger *logger) 
-        : incoming_requests(client_requests), logger_(logger) {}
+        // one request queue per matching engine shard, requests are routed by ticker
+        // max_pending_requests -> per shard, a shard that is full turns requests down instead of failing
+        FIFOSequencer(const ClientRequestLFQueues &client_requests, size_t num_shards, Logger *logger, size_t max_pending_requests = ME_MAX_PENDING_REQUESTS)
+        : incoming_requests_(client_requests), num_shards_(num_shards), logger_(logger), max_pending_requests_(max_pending_requests) {
+            ASSERT(max_pending_requests_, "FIFOSequencer needs room for at least one request per shard");
+            for(size_t shard = 0; shard < num_shards_; ++shard) {
+                auto &pending = pending_[shard];
+                pending.requests_.resize(max_pending_requests_);
+                pending.run_starts_.reserve(max_pending_requests_);
+            }
+            // a shard never has more runs than requests
+            heap_.reserve(max_pending_requests_);
+            run_next_.resize(max_pending_requests_);
+            run_end_.resize(max_pending_requests_);
+        }
 
         ~FIFOSequencer() {}
 
-        auto addClientRequest(Nanos rx_time, const MEClientRequest &request) {
-            if(pending_size_ >= pending_client_requests_.size()){
-                FATAL("Too many pending requests");
+        // false -> no room left for the request, nothing was added and the caller has to turn it down
+        auto addClientRequest(Nanos rx_time, const MEClientRequest &request) -> bool {
+            if(UNLIKELY(request.type_ == ClientRequestType::MASS_CANCEL && request.ticker_id_ == TickerId_INVALID)) {
+                // mass cancel for every ticker -> every shard has to see it
+                for(size_t shard = 0; shard < num_shards_; ++shard) {
+                    if(pending_[shard].size_ >= max_pending_requests_) {
+                        return false;
+                    }
+                }
+                for(size_t shard = 0; shard < num_shards_; ++shard) {
+                    addPendingRequest(rx_time, shard, request);
+                }
+                return true;
             }
-            pending_client_requests_.at(pending_size_++) = move(RecvTimeClientRequest{rx_time, request});
+            const auto shard = tickerToShard(request.ticker_id_, num_shards_);
+            if(UNLIKELY(pending_[shard].size_ >= max_pending_requests_)) {
+                return false;
+            }
+            addPendingRequest(rx_time, shard, request);
+            return true;
         }
 
         auto sequenceAndPublish() {
-            if(UNLIKELY(!pending_size_)){
-                return;
-            }
-
-            // log 
-
-            sort(pending_client_requests_.begin(), pending_client_requests_.begin() + pending_size_);
-
-            for(size_t i=0; i < pending_size_; ++i) {
-                const auto &client_request = pending_client_requests_.at(i);
-
-                // log 
-
-                auto next_write = incoming_requests->getNextToWriteTo();
-                *next_write = move(client_request.request_);
-                incoming_requests->updateWriteIndex();
-
-                pending_size_ = 0;
+            // log
+            for(size_t shard = 0; shard < num_shards_; ++shard) {
+                if(pending_[shard].size_) {
+                    publishShard(shard);
+                }
             }
         }
 
@@ -55,21 +78,110 @@ namespace Exchange {
         FIFOSequencer &operator=(const FIFOSequencer &&) = delete;
 
     private:
-        ClientRequestLFQueue *incoming_requests = nullptr;
-
-        string time_str;
-        Logger *logger_ = nullptr;
-
         struct RecvTimeClientRequest {
             Nanos recv_time_ = 0;
             MEClientRequest request_;
+        };
 
-            auto operator<(const RecvTimeClientRequest &rhs) const {
-                return (recv_time_ < rhs.recv_time_);
+        struct PendingRequests {
+            vector<RecvTimeClientRequest> requests_;
+            size_t size_ = 0;
+            // index of the first request of each run, in the order the runs were added
+            vector<size_t> run_starts_;
+        };
+
+        // next request of a run in the merge, ties in receive time go to the run added first
+        struct RunHead {
+            Nanos recv_time_ = 0;
+            size_t run_ = 0;
+
+            // heap algorithms build max heaps -> reversed to keep the earliest head on top
+            auto operator<(const RunHead &rhs) const {
+                return (recv_time_ > rhs.recv_time_ || (recv_time_ == rhs.recv_time_ && run_ > rhs.run_));
             }
         };
 
-        array<RecvTimeClientRequest, ME_MAX_PENDING_REQUESTS> pending_client_requests_;
-        size_t pending_size_ = 0;
+        auto addPendingRequest(Nanos rx_time, size_t shard, const MEClientRequest &request) -> void {
+            auto &pending = pending_[shard];
+            if(!pending.size_ || rx_time < pending.requests_[pending.size_ - 1].recv_time_) {
+                pending.run_starts_.push_back(pending.size_);
+            }
+            pending.requests_[pending.size_++] = RecvTimeClientRequest{rx_time, request};
+        }
+
+        // merges the shard's runs into its queue, publishing each reserved span with a single index update
+        // requests a full shard queue could not take stay pending, still in runs, for the next round
+        auto publishShard(size_t shard) -> void {
+            auto &pending = pending_[shard];
+            auto &requests = pending.requests_;
+            const auto num_runs = pending.run_starts_.size();
+
+            heap_.clear();
+            for(size_t run = 0; run < num_runs; ++run) {
+                run_next_[run] = pending.run_starts_[run];
+                run_end_[run] = (run + 1 < num_runs ? pending.run_starts_[run + 1] : pending.size_);
+                heap_.push_back(RunHead{requests[run_next_[run]].recv_time_, run});
+            }
+            // runs are added in order, with one run there is nothing to merge
+            if(num_runs > 1) {
+                make_heap(heap_.begin(), heap_.end());
+            }
+
+            auto incoming_requests = incoming_requests_[shard];
+            auto remaining = pending.size_;
+            while(remaining) {
+                size_t num_slots = 0;
+                auto next_write = incoming_requests->getNextToWriteTo(remaining, &num_slots);
+                if(UNLIKELY(!num_slots)) {
+                    // matching engine is behind, only this shard waits
+                    break;
+                }
+                for(size_t j = 0; j < num_slots; ++j) {
+                    // log
+                    const auto run = heap_.front().run_;
+                    next_write[j] = requests[run_next_[run]++].request_;
+                    pop_heap(heap_.begin(), heap_.end());
+                    if(run_next_[run] < run_end_[run]) {
+                        heap_.back().recv_time_ = requests[run_next_[run]].recv_time_;
+                        push_heap(heap_.begin(), heap_.end());
+                    } else {
+                        heap_.pop_back();
+                    }
+                }
+                incoming_requests->updateWriteIndex(num_slots);
+                remaining -= num_slots;
+            }
+
+            if(LIKELY(!remaining)) {
+                pending.size_ = 0;
+                pending.run_starts_.clear();
+                return;
+            }
+            // what is left of each run moves to the front, runs stay in the order they were added
+            size_t size = 0;
+            pending.run_starts_.clear();
+            for(size_t run = 0; run < num_runs; ++run) {
+                if(run_next_[run] < run_end_[run]) {
+                    pending.run_starts_.push_back(size);
+                    move(requests.begin() + run_next_[run], requests.begin() + run_end_[run], requests.begin() + size);
+                    size += run_end_[run] - run_next_[run];
+                }
+            }
+            pending.size_ = size;
+        }
+
+        ClientRequestLFQueues incoming_requests_;
+        const size_t num_shards_ = 1;
+
+        string time_str;
+        Logger *logger_ = nullptr;
+
+        const size_t max_pending_requests_ = ME_MAX_PENDING_REQUESTS;
+        array<PendingRequests, ME_MAX_SHARDS> pending_;
+
+        // merge scratch space, sized for the most runs a shard can have
+        vector<RunHead> heap_;
+        vector<size_t> run_next_;
+        vector<size_t> run_end_;
     };
-}
\ No newline at end of file
+}
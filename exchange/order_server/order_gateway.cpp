@@ -0,0 +1,44 @@
+#include "order_gateway.h"
+
+namespace Exchange {
+    OrderGateway::OrderGateway(int8_t gateway_id, FIFOSequencer *fifo_sequencer, GatewayRequestLFQueue *outgoing_requests, ClientResponseLFQueue *incoming_responses,
+                               ClientGatewayMap *cid_gateway, const OMThrottleCfgHashMap &throttle_cfg, ClientId auction_control_client_id, TCPServerBackend tcp_backend, Logger *logger)
+    : gateway_id_(gateway_id), fifo_sequencer_(fifo_sequencer), outgoing_requests_(outgoing_requests), incoming_responses_(incoming_responses), cid_gateway_(cid_gateway),
+      auction_control_client_id_(auction_control_client_id), logger_(logger), tcp_server_(*logger, TCPRecvBufferSize, TCPSendBufferSize, tcp_backend) {
+        ASSERT(!fifo_sequencer_ != !outgoing_requests_, "OrderGateway needs either a sequencer or a request queue, gateway:" + to_string(gateway_id_));
+        // initially all the sequence numbers are 1
+        cid_next_outgoing_seq_num_.fill(1);
+        cid_next_exp_seq_num_.fill(1);
+        cid_tcp_socket_.fill(nullptr);
+        for(size_t client_id = 0; client_id < ME_MAX_NUM_CLIENTS; ++client_id) {
+            const auto &cfg = throttle_cfg[client_id];
+            ASSERT(cfg.msgs_per_sec_ && cfg.burst_, "Invalid throttle for client:" + to_string(client_id));
+            auto &throttle = cid_throttle_[client_id];
+            throttle.emission_interval_ = NANOS_TO_SECS / cfg.msgs_per_sec_;
+            throttle.tolerance_ = throttle.emission_interval_ * (cfg.burst_ - 1);
+        }
+
+        tcp_server_.recv_callback_= [this](auto socket, auto rx_time) {recvCallback(socket, rx_time);};
+        tcp_server_.recv_finished_callback_ = [this](){recvFinishedCallback();};
+        tcp_server_.disconnect_callback_ = [this](auto socket) {disconnectCallback(socket);};
+    }
+
+    OrderGateway::~OrderGateway() {
+        stop();
+    }
+
+    auto OrderGateway::listen(const string &iface, int port, bool reuse_port) -> void {
+        // start listening for new connections on the given port
+        tcp_server_.listen(iface, port, reuse_port);
+    }
+
+    auto OrderGateway::start() -> void {
+        run_ = true;
+        ASSERT(Common::createAndStartThread(-1, "Exchange/OrderGateway " + to_string(gateway_id_), [this]() {run();}) != nullptr,
+               "Failed to start OrderGateway thread:" + to_string(gateway_id_));
+    }
+
+    auto OrderGateway::stop() -> void {
+        run_ = false;
+    }
+}
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+#include "common/thread_utils.h"
+#include "common/macros.h"
+#include "common/tcp_server.h"
+
+#include "order_server/client_request.h"
+#include "order_server/client_response.h"
+#include "fifo_sequencer.h"
+
+using namespace std;
+
+// client sessions -> tcp connections, sequence numbers, throttling, decoding of requests and encoding of responses
+// the order server runs one gateway itself, next to the sequencer, or several gateway threads that each own the sessions that connect to them
+
+namespace Exchange {
+    // most gateway threads of one order server
+    constexpr size_t OM_MAX_GATEWAYS = 8;
+    // requests from a gateway thread not picked up by the sequencer yet, a full queue turns requests down as OVERLOADED
+    // power of 2, queue indices are masked
+    constexpr size_t OM_GATEWAY_MAX_PENDING_REQUESTS = 64 * 1024;
+
+    // token bucket per client, requests over the rate are rejected right at the order server
+    struct OMThrottleCfg {
+        // bucket refill rate
+        uint32_t msgs_per_sec_ = 100 * 1000;
+        // bucket size, most requests accepted back to back
+        uint32_t burst_ = 1024;
+    };
+
+    // client -> throttle configuration
+    typedef array<OMThrottleCfg, ME_MAX_NUM_CLIENTS> OMThrottleCfgHashMap;
+
+    // request read by a gateway thread, on its way to the sequencer thread
+    struct GatewayClientRequest {
+        Nanos rx_time_ = 0;
+        MEClientRequest request_;
+    };
+
+    typedef SPSCLFQueue<GatewayClientRequest, HugePageAllocator<GatewayClientRequest>> GatewayRequestLFQueue;
+
+    // client -> gateway holding its session, -1 -> no session
+    // claimed by the first request of a session and given up on disconnect, so a client id is live on one gateway at a time
+    typedef array<atomic<int8_t>, ME_MAX_NUM_CLIENTS> ClientGatewayMap;
+
+    class OrderGateway {
+    public:
+        // requests go to fifo_sequencer right away -> runs on the sequencer thread, its owner hands it responses with sendClientResponse()
+        // requests go to outgoing_requests -> runs on its own thread, responses come in through incoming_responses
+        OrderGateway(int8_t gateway_id, FIFOSequencer *fifo_sequencer, GatewayRequestLFQueue *outgoing_requests, ClientResponseLFQueue *incoming_responses,
+                     ClientGatewayMap *cid_gateway, const OMThrottleCfgHashMap &throttle_cfg, ClientId auction_control_client_id, TCPServerBackend tcp_backend, Logger *logger);
+
+        ~OrderGateway();
+
+        // reuse_port -> every gateway listens on the same port, the kernel spreads new connections over them
+        auto listen(const string &iface, int port, bool reuse_port) -> void;
+
+        // gateway thread
+        auto start() -> void;
+
+        auto stop() -> void;
+
+        // one round of network io, and of the responses handed over by the sequencer thread
+        auto poll() noexcept {
+            // cancels of clients that disconnected go out ahead of anything read this round
+            if(UNLIKELY(num_pending_cancels_)) {
+                retryPendingCancels();
+            }
+            // poll for socket activity, fill the events_ array
+            tcp_server_.poll();
+            // process the incoming and outgoing data of every connected socket
+            tcp_server_.sendAndRecv();
+
+            if(incoming_responses_) {
+                size_t num_responses = 0;
+                for(auto client_responses = incoming_responses_->getNextToRead(ME_QUEUE_BATCH_SIZE, &num_responses); client_responses;
+                    client_responses = incoming_responses_->getNextToRead(ME_QUEUE_BATCH_SIZE, &num_responses)) {
+                    for(size_t i = 0; i < num_responses; ++i) {
+                        sendClientResponse(&client_responses[i]);
+                    }
+                    incoming_responses_->updateReadIndex(num_responses);
+                }
+            }
+        }
+
+        auto run() noexcept {
+            // log
+            while(run_) {
+                poll();
+            }
+        }
+
+        // sends a response on the client's socket with the client's next outgoing sequence number
+        auto sendClientResponse(const MEClientResponse *client_response) noexcept -> void {
+            // get the next outgoing sequence number for that client
+            auto &next_outgoing_seq_num = cid_next_outgoing_seq_num_[client_response->client_id_];
+            // log
+
+            if(UNLIKELY(cid_tcp_socket_[client_response->client_id_] == nullptr)) {
+                // client disconnected, eg. the cancels from cancel-on-disconnect -> nobody to send them to
+                return;
+            }
+            // sequence number and response queued as one OMClientResponse -> one copy into the socket's outbound ring,
+            // everything queued in a burst goes out with the socket's next send()
+            const OMClientResponse om_client_response{next_outgoing_seq_num, *client_response};
+            if(UNLIKELY(!cid_tcp_socket_[client_response->client_id_]->send(&om_client_response, sizeof(om_client_response)))) {
+                // client is not reading its responses, the socket shuts the session down -> cancel-on-disconnect once it is closed
+                return;
+            }
+
+            ++next_outgoing_seq_num;
+        }
+
+        auto recvCallback(TCPSocket *socket, Nanos rx_time) noexcept {
+            // log
+            if (socket->inbound_ring_.readable() >= sizeof(OMClientRequest)) {
+                // one clock read for everything read from the socket, rx_time is 0 without kernel timestamps
+                const auto now = getCurrentNanos();
+                // complete requests are contiguous in the ring even across its end, read in place
+                const auto inbound_data = socket->inbound_ring_.readPtr();
+                const auto inbound_len = socket->inbound_ring_.readable();
+                last_rx_time_ = max(last_rx_time_, rx_time);
+                size_t i =0;
+                for(; i + sizeof(OMClientRequest) <= inbound_len; i += sizeof(OMClientRequest)) {
+                    // get the request from inbound data
+                    auto request = reinterpret_cast<const OMClientRequest *>(inbound_data + i);
+                    // log
+
+                    // client id comes off the network, checked before it indexes any table
+                    if(UNLIKELY(request->me_client_request.client_id_ >= ME_MAX_NUM_CLIENTS)) {
+                        // log
+                        continue;
+                    }
+
+                    // if socket does not exist for that client, add one
+                    // unless the client already has a session on another gateway
+                    if(UNLIKELY(cid_tcp_socket_[request->me_client_request.client_id_] == nullptr)) {
+                        int8_t no_gateway = -1;
+                        if(!(*cid_gateway_)[request->me_client_request.client_id_].compare_exchange_strong(no_gateway, gateway_id_)) {
+                            // log
+                            continue;
+                        }
+                        cid_tcp_socket_[request->me_client_request.client_id_] = socket;
+                    }
+
+                    // wrong socket -> skip
+                    if(cid_tcp_socket_[request->me_client_request.client_id_] != socket) {
+                        // log
+                        continue;
+                    }
+
+                    // check if the sequence number of that message is the same one that we are expecting to receive
+                    auto &next_exp_seq_num = cid_next_exp_seq_num_[request->me_client_request.client_id_];
+                    if(request->seq_num_ != next_exp_seq_num) {
+                        // log
+                        continue;
+                    }
+
+                    ++next_exp_seq_num;
+                    // ticker id picks the shard and indexes the matching engine's books, checked like the client id
+                    if(UNLIKELY(request->me_client_request.ticker_id_ >= ME_MAX_TICKERS &&
+                                !(request->me_client_request.type_ == ClientRequestType::MASS_CANCEL && request->me_client_request.ticker_id_ == TickerId_INVALID))) {
+                        sendRejected(request->me_client_request, RejectReason::INVALID_TICKER);
+                        continue;
+                    }
+                    // auctions halt and uncross a whole ticker, not something any client can do
+                    if(UNLIKELY((request->me_client_request.type_ == ClientRequestType::AUCTION_START || request->me_client_request.type_ == ClientRequestType::AUCTION_UNCROSS) &&
+                                request->me_client_request.client_id_ != auction_control_client_id_)) {
+                        sendRejected(request->me_client_request, RejectReason::NOT_PERMITTED);
+                        continue;
+                    }
+                    if(UNLIKELY(!takeToken(request->me_client_request.client_id_, now))) {
+                        sendRejected(request->me_client_request, RejectReason::THROTTLED);
+                        continue;
+                    }
+                    // forward the client request to the sequencer, turned down if the matching engine side is backed up
+                    if(UNLIKELY(!forwardRequest(rx_time, request->me_client_request))) {
+                        sendRejected(request->me_client_request, RejectReason::OVERLOADED);
+                    }
+                }
+                // partial request at the end stays in the ring, no compaction
+                socket->inbound_ring_.consume(i);
+            }
+        }
+
+        auto recvFinishedCallback() noexcept {
+            if(fifo_sequencer_) {
+                fifo_sequencer_->sequenceAndPublish();
+            }
+        }
+
+        // cancel-on-disconnect, one mass cancel per client of that socket pulls all its orders in a single engine pass
+        // client can connect again, starts a new session with sequence numbers from 1
+        auto disconnectCallback(TCPSocket *socket) noexcept {
+            for(size_t client_id = 0; client_id < ME_MAX_NUM_CLIENTS; ++client_id) {
+                if(cid_tcp_socket_[client_id] != socket) {
+                    continue;
+                }
+                logger_->log("%:% %() % client:% disconnected, canceling all its orders\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, client_id);
+                cid_tcp_socket_[client_id] = nullptr;
+                cid_next_exp_seq_num_[client_id] = 1;
+                cid_next_outgoing_seq_num_[client_id] = 1;
+                cid_throttle_[client_id].full_time_ = 0;
+                // the cancel cannot be turned down like a client request, it waits for room instead
+                if(UNLIKELY(!forwardMassCancel(static_cast<ClientId>(client_id)))) {
+                    logger_->log("%:% %() % no room for cancel-on-disconnect of client:%, retried next round\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, client_id);
+                    pending_cancels_[num_pending_cancels_++] = static_cast<ClientId>(client_id);
+                }
+            }
+            recvFinishedCallback();
+        }
+
+        OrderGateway() = delete;
+        OrderGateway(const OrderGateway &) = delete;
+        OrderGateway(const OrderGateway &&) = delete;
+        OrderGateway &operator=(const OrderGateway &) = delete;
+        OrderGateway &operator=(const OrderGateway &&) = delete;
+
+    private:
+        // token bucket as the time it is full again, each request moves it by one emission interval
+        // bucket holds burst tokens -> request is over the rate once that time is more than (burst - 1) intervals away
+        struct ClientThrottle {
+            Nanos emission_interval_ = 0;
+            Nanos tolerance_ = 0;
+            Nanos full_time_ = 0;
+        };
+
+        auto takeToken(ClientId client_id, Nanos now) noexcept -> bool {
+            auto &throttle = cid_throttle_[client_id];
+            const auto full_time = max(throttle.full_time_, now);
+            if(full_time - now > throttle.tolerance_) {
+                return false;
+            }
+            throttle.full_time_ = full_time + throttle.emission_interval_;
+            return true;
+        }
+
+        // false -> no room for the request on the way to the matching engine
+        auto forwardRequest(Nanos rx_time, const MEClientRequest &request) noexcept -> bool {
+            if(fifo_sequencer_) {
+                return fifo_sequencer_->addClientRequest(rx_time, request);
+            }
+            size_t num_slots = 0;
+            auto next_write = outgoing_requests_->getNextToWriteTo(1, &num_slots);
+            if(UNLIKELY(!num_slots)) {
+                return false;
+            }
+            *next_write = GatewayClientRequest{rx_time, request};
+            outgoing_requests_->updateWriteIndex(1);
+            return true;
+        }
+
+        // false -> no room, the client keeps its gateway until the cancel is forwarded
+        // -> a new session of the client cannot start and get orders in ahead of the cancel
+        // stamped with the latest receive time of the gateway, same clock as the requests it is merged with,
+        // -> sequenced right after everything read before the disconnect, ties go to what was added first
+        auto forwardMassCancel(ClientId client_id) noexcept -> bool {
+            const MEClientRequest mass_cancel{ClientRequestType::MASS_CANCEL, client_id, TickerId_INVALID,
+                                              OrderId_INVALID, Side::INVALID, Price_INVALID, Qty_INVALID};
+            if(!forwardRequest(last_rx_time_, mass_cancel)) {
+                return false;
+            }
+            (*cid_gateway_)[client_id].store(-1);
+            return true;
+        }
+
+        // pending cancels keep the order they disconnected in
+        auto retryPendingCancels() noexcept -> void {
+            size_t num_left = 0;
+            for(size_t i = 0; i < num_pending_cancels_; ++i) {
+                if(!forwardMassCancel(pending_cancels_[i])) {
+                    pending_cancels_[num_left++] = pending_cancels_[i];
+                }
+            }
+            num_pending_cancels_ = num_left;
+            // sequencer gets to publish them even if nothing is read this round
+            recvFinishedCallback();
+        }
+
+        // request turned down by the order server itself, never reaches the matching engine
+        auto sendRejected(const MEClientRequest &client_request, RejectReason reject_reason) noexcept -> void {
+            logger_->log("%:% %() % rejected:% %\n", __FILE__, __LINE__, __FUNCTION__, Common::LOG_TIME, rejectReasonToString(reject_reason), client_request.toString());
+            const MEClientResponse client_response = {
+                ClientResponseType::REJECTED,
+                client_request.client_id_,
+                client_request.ticker_id_,
+                client_request.order_id_,
+                OrderId_INVALID,
+                client_request.side_,
+                client_request.price_,
+                Qty_INVALID,
+                client_request.qty_,
+                reject_reason
+            };
+            sendClientResponse(&client_response);
+        }
+
+        const int8_t gateway_id_ = 0;
+        // exactly one of the two is set
+        FIFOSequencer *fifo_sequencer_ = nullptr;
+        GatewayRequestLFQueue *outgoing_requests_ = nullptr;
+        ClientResponseLFQueue *incoming_responses_ = nullptr;
+        ClientGatewayMap *cid_gateway_ = nullptr;
+        const ClientId auction_control_client_id_ = ClientId_INVALID;
+        // latest rx_time handed to recvCallback(), the receive time given to cancel-on-disconnect
+        Nanos last_rx_time_ = 0;
+
+        volatile bool run_ = false;
+
+        string time_str_;
+        Logger *logger_ = nullptr;
+
+        array<size_t, ME_MAX_NUM_CLIENTS> cid_next_outgoing_seq_num_;
+        array<size_t, ME_MAX_NUM_CLIENTS> cid_next_exp_seq_num_;
+
+        array<Common::TCPSocket *, ME_MAX_NUM_CLIENTS> cid_tcp_socket_;
+        array<ClientThrottle, ME_MAX_NUM_CLIENTS> cid_throttle_;
+
+        // disconnected clients whose mass cancel found no room yet, a client is in here atmost once
+        array<ClientId, ME_MAX_NUM_CLIENTS> pending_cancels_;
+        size_t num_pending_cancels_ = 0;
+
+        Common::TCPServer tcp_server_;
+    };
+}
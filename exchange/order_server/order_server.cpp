@@ -1,17 +1,32 @@
 #include "order_server.h"
 
 namespace Exchange {
-    OrderServer::OrderServer(ClientRequestLFQueue *client_requests, ClientResponseLFQueue *client_responses, const string &iface, int port)
-    : iface_(iface), port_(port), outgoing_responses_(client_responses), logger_("exchange_order_server.log"), tcp_server_(logger_), fifo_sequencer_(client_requests, &logger_) {
+    OrderServer::OrderServer(const ClientRequestLFQueues &client_requests, const ClientResponseLFQueues &client_responses, size_t num_shards, const string &iface, int port,
+                             const OMThrottleCfgHashMap &throttle_cfg, TCPServerBackend tcp_backend, size_t num_gateways, ClientId auction_control_client_id)
+    : iface_(iface), port_(port), outgoing_responses_(client_responses), num_shards_(num_shards), num_gateways_(num_gateways), logger_("exchange_order_server.log"),
+      fifo_sequencer_(client_requests, num_shards, &logger_) {
         // list of client responses given to constructor -> populates the outgoing_responses_
         // list of client_requests given to constructor -> passed on to the fifo sequencer
-        // initially all the sequence numbers are 1
-        cid_next_outgoing_seq_num_.fill(1);
-        cid_next_exp_seq_num_.fill(1);
-        cid_tcp_socket_.fill(nullptr);
+        ASSERT(num_gateways_ <= OM_MAX_GATEWAYS, "Too many order gateways:" + to_string(num_gateways_));
+        for(auto &gateway : cid_gateway_) {
+            gateway.store(-1);
+        }
+        gateways_.fill(nullptr);
+        gateway_loggers_.fill(nullptr);
+        gateway_requests_.fill(nullptr);
+        gateway_responses_.fill(nullptr);
 
-        tcp_server_.recv_callback_= [this](auto socket, auto rx_time) {recvCallback(socket, rx_time);};
-        tcp_server_.recv_finished_callback_ = [this](){recvFinishedCallback();};
+        if(!num_gateways_) {
+            inline_gateway_ = new OrderGateway(0, &fifo_sequencer_, nullptr, nullptr, &cid_gateway_, throttle_cfg, auction_control_client_id, tcp_backend, &logger_);
+            return;
+        }
+        for(size_t g = 0; g < num_gateways_; ++g) {
+            gateway_loggers_[g] = new Logger("exchange_order_gateway_" + to_string(g) + ".log");
+            gateway_requests_[g] = new GatewayRequestLFQueue(OM_GATEWAY_MAX_PENDING_REQUESTS);
+            gateway_responses_[g] = new ClientResponseLFQueue(ME_MAX_CLIENT_UPDATES);
+            gateways_[g] = new OrderGateway(static_cast<int8_t>(g), nullptr, gateway_requests_[g], gateway_responses_[g], &cid_gateway_,
+                                            throttle_cfg, auction_control_client_id, tcp_backend, gateway_loggers_[g]);
+        }
     }
 
     OrderServer::~OrderServer() {
@@ -19,18 +34,36 @@ namespace Exchange {
 
         using namespace literals::chrono_literals;
         this_thread::sleep_for(1s);
+
+        delete inline_gateway_;
+        for(size_t g = 0; g < num_gateways_; ++g) {
+            delete gateways_[g];
+            delete gateway_requests_[g];
+            delete gateway_responses_[g];
+            delete gateway_loggers_[g];
+        }
     }
 
     auto OrderServer::start() -> void {
         run_ = true;
-        // start listening for new connections on the given port 
-        tcp_server_.listen(iface_, port_);
+        // start listening for new connections on the given port
+        if(!num_gateways_) {
+            inline_gateway_->listen(iface_, port_, false);
+        }
+        // every gateway has its own listener on the port, connections are spread over them by the kernel
+        for(size_t g = 0; g < num_gateways_; ++g) {
+            gateways_[g]->listen(iface_, port_, true);
+            gateways_[g]->start();
+        }
 
         // run() which is the main loop of order_server, runs on a new thread
         ASSERT(Common::createAndStartThread(-1, "Exchange/OrderServer", [this]() {run();}) != nullptr, "Failed to start OrderServer thread");
     }
 
     auto OrderServer::stop() -> void {
+        for(size_t g = 0; g < num_gateways_; ++g) {
+            gateways_[g]->stop();
+        }
         run_ = false;
     }
-}
\ No newline at end of file
+}
@@ -9,13 +9,21 @@
 #include "order_server/client_request.h"
 #include "order_server/client_response.h"
 #include "fifo_sequencer.h"
+#include "order_gateway.h"
 
 using namespace std;
 
 namespace Exchange {
     class OrderServer {
     public:
-        OrderServer(ClientRequestLFQueue *client_requests, ClientResponseLFQueue *client_responses, const string &iface, int port);
+        // one request and one response queue per matching engine shard
+        // tcp_backend -> how client connections are served, see TCPServerBackend
+        // num_gateways 0 -> client sessions run on the order server thread itself, next to the sequencer
+        // num_gateways N -> N gateway threads share the port and the client sessions, the order server thread only merges and sequences
+        // auction_control_client_id -> only client whose AUCTION_START / AUCTION_UNCROSS go through, INVALID -> nobody's
+        OrderServer(const ClientRequestLFQueues &client_requests, const ClientResponseLFQueues &client_responses, size_t num_shards, const string &iface, int port,
+                    const OMThrottleCfgHashMap &throttle_cfg = OMThrottleCfgHashMap{}, TCPServerBackend tcp_backend = TCPServerBackend::EPOLL, size_t num_gateways = 0,
+                    ClientId auction_control_client_id = ClientId_INVALID);
 
         ~OrderServer();
 
@@ -23,70 +31,56 @@ namespace Exchange {
 
         auto stop() -> void;
 
-        auto run() noexcept {
-            // log 
-            while(run_) {
-                // poll for socket activity, fill the events_ array
-                tcp_server_.poll();
-                // process the incoming and outgoing data, for send_sockets_ and receive_sockets_
-                tcp_server_.sendAndRecv();
-
-                // iterate over the outgoing responses array
-                for(auto client_response = outgoing_responses_->getNextToRead(); outgoing_responses_->size() && client_response; client_response = outgoing_responses_->getNextToRead()){
-                    // get the next outgoing sequence number for that client
-                    auto &next_outgoing_seq_num = cid_next_outgoing_seq_num_[client_response->client_id_];
-                    // log 
-
-                    ASSERT(cid_tcp_socket_[client_response->client_id_] != nullptr, "");
-                    // first send the sequence number
-                    cid_tcp_socket_[client_response->client_id_]->send(&next_outgoing_seq_num, sizeof(next_outgoing_seq_num));
-                    // then send the actuall data 
-                    cid_tcp_socket_[client_response->client_id_]->send(client_response, sizeof(MEClientResponse));
-
-                    outgoing_responses_->updateReadIndex();
-                    ++next_outgoing_seq_num;
+        // hands out every response the shard has published so far, to the gateway holding the client's session
+        // a gateway that is behind leaves the rest in the shard queue for the next round
+        auto drainResponses(ClientResponseLFQueue *outgoing_responses) noexcept {
+            size_t num_responses = 0;
+            for(auto client_responses = outgoing_responses->getNextToRead(ME_QUEUE_BATCH_SIZE, &num_responses); client_responses; client_responses = outgoing_responses->getNextToRead(ME_QUEUE_BATCH_SIZE, &num_responses)){
+                size_t i = 0;
+                for(; i < num_responses && routeClientResponse(&client_responses[i]); ++i) {
+                }
+                outgoing_responses->updateReadIndex(i);
+                if(UNLIKELY(i < num_responses)) {
+                    return;
                 }
             }
         }
 
-        auto recvCallback(TCPSocket *socket, Nanos rx_time) noexcept {
-            // log 
-            if (socket->next_rcv_valid_index_ >= sizeof(OMClientRequest)) {
-                size_t i =0;
-                for(; i + sizeof(OMClientRequest) <= socket->next_rcv_valid_index_; i += sizeof(OMClientRequest)) {
-                    // get the request from inbound data
-                    auto request = reinterpret_cast<const OMClientRequest *>(socket->inbound_data_.data() + i);
-                    // log 
-
-                    // if socket does not exist for that client, add one
-                    if(UNLIKELY(cid_tcp_socket_[request->me_client_request.client_id_] == nullptr)) {
-                        cid_tcp_socket_[request->me_client_request.client_id_] = socket;
-                    }
-
-                    // wrong socket -> skip
-                    if(cid_tcp_socket_[request->me_client_request.client_id_] != socket) {
-                        // log 
-                        continue;
+        // requests of every gateway thread into the sequencer, which orders them by receive time across gateways
+        // a full sequencer leaves the rest in the gateway queues, a different gateway goes first each round
+        auto mergeRequests() noexcept {
+            for(size_t g = 0; g < num_gateways_; ++g) {
+                auto gateway_requests = gateway_requests_[(next_gateway_ + g) % num_gateways_];
+                size_t num_requests = 0;
+                for(auto requests = gateway_requests->getNextToRead(ME_QUEUE_BATCH_SIZE, &num_requests); requests; requests = gateway_requests->getNextToRead(ME_QUEUE_BATCH_SIZE, &num_requests)) {
+                    size_t i = 0;
+                    for(; i < num_requests && fifo_sequencer_.addClientRequest(requests[i].rx_time_, requests[i].request_); ++i) {
                     }
-
-                    // check if the sequence number of that message is the same one that we are expecting to receive
-                    auto &next_exp_seq_num = cid_next_exp_seq_num_[request->me_client_request.client_id_];
-                    if(request->seq_num_ != next_exp_seq_num) {
-                        // log 
-                        continue;
+                    gateway_requests->updateReadIndex(i);
+                    if(UNLIKELY(i < num_requests)) {
+                        break;
                     }
-
-                    ++next_exp_seq_num;
-                    // forward the client request to fifo sequencer
-                    fifo_sequencer_.addClientRequest(rx_time, request->me_client_request);
                 }
-                memcpy(socket->inbound_data_.data(), socket->inbound_data_.data() + i, socket->next_rcv_valid_index_ - i);
-                socket->next_rcv_valid_index_ -= i;
             }
+            next_gateway_ = (next_gateway_ + 1) % num_gateways_;
+            fifo_sequencer_.sequenceAndPublish();
         }
 
-        auto recvFinishedCallback() noexcept {
-            fifo_sequencer_.sequenceAndPublish();
+        auto run() noexcept {
+            // log 
+            while(run_) {
+                if(num_gateways_) {
+                    mergeRequests();
+                } else {
+                    // sessions served right here, requests reach the sequencer from the recv callbacks
+                    inline_gateway_->poll();
+                }
+
+                // drain the outgoing responses of every shard in bursts, one read index update per burst
+                for(size_t shard = 0; shard < num_shards_; ++shard) {
+                    drainResponses(outgoing_responses_[shard]);
+                }
+            }
         }
 
         OrderServer() = delete;
@@ -96,22 +90,51 @@ namespace Exchange {
         OrderServer &operator=(const OrderServer &&) = delete;
 
     private:
+        // false -> the gateway of the client has no room for the response right now
+        auto routeClientResponse(const MEClientResponse *client_response) noexcept -> bool {
+            if(!num_gateways_) {
+                inline_gateway_->sendClientResponse(client_response);
+                return true;
+            }
+            const auto gateway = (LIKELY(client_response->client_id_ < ME_MAX_NUM_CLIENTS) ? cid_gateway_[client_response->client_id_].load() : -1);
+            if(UNLIKELY(gateway < 0)) {
+                // client disconnected, eg. the cancels from cancel-on-disconnect -> nobody to send them to
+                return true;
+            }
+            auto gateway_responses = gateway_responses_[gateway];
+            size_t num_slots = 0;
+            auto next_write = gateway_responses->getNextToWriteTo(1, &num_slots);
+            if(UNLIKELY(!num_slots)) {
+                return false;
+            }
+            *next_write = *client_response;
+            gateway_responses->updateWriteIndex(1);
+            return true;
+        }
+
         const string iface_;
         const int port_;
 
-        ClientResponseLFQueue *outgoing_responses_ = nullptr;
+        ClientResponseLFQueues outgoing_responses_;
+        const size_t num_shards_ = 1;
+        const size_t num_gateways_ = 0;
         volatile bool run_ = false;
 
         string time_str_;
         Logger logger_; 
 
-        array<size_t, ME_MAX_NUM_CLIENTS> cid_next_outgoing_seq_num_;
-        array<size_t, ME_MAX_NUM_CLIENTS> cid_next_exp_seq_num_;
+        ClientGatewayMap cid_gateway_;
+
+        // num_gateways_ == 0
+        OrderGateway *inline_gateway_ = nullptr;
 
-        array<Common::TCPSocket *, ME_MAX_NUM_CLIENTS> cid_tcp_socket_;
+        // num_gateways_ > 0, each gateway thread has its own logger and a queue in each direction
+        array<OrderGateway *, OM_MAX_GATEWAYS> gateways_;
+        array<Logger *, OM_MAX_GATEWAYS> gateway_loggers_;
+        array<GatewayRequestLFQueue *, OM_MAX_GATEWAYS> gateway_requests_;
+        array<ClientResponseLFQueue *, OM_MAX_GATEWAYS> gateway_responses_;
+        size_t next_gateway_ = 0;
 
-        Common::TCPServer tcp_server_;
-        
         FIFOSequencer fifo_sequencer_;
     };
 }
\ No newline at end of file
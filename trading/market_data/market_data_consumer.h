@@ -4,7 +4,7 @@
 #include <map>
 
 #include "common/thread_utils.h"
-#include "common/lf_queue.h"
+#include "common/spsc_lf_queue.h"
 #include "common/macros.h"
 #include "common/mcast_socket.h"
 